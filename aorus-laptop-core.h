@@ -0,0 +1,535 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  aorus-laptop-core.h - Firmware interface of the AORUS laptop WMI driver
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Method IDs, EC registers and the encodings the firmware expects. None of
+ *  it touches the firmware, so the tests build it against the emulator in
+ *  tests/ instead. Outside the kernel, the includer provides the kernel
+ *  types and helpers used here.
+ */
+
+#ifndef _AORUS_LAPTOP_CORE_H
+#define _AORUS_LAPTOP_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/bitops.h>
+#include <linux/build_bug.h>
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#endif
+
+/* WMI method arguments */
+// Not supported by Aero 14 W
+#define GPU_QBOOST       0x51
+#define FAN_SILENT_MODE  0x57
+#define CHARGING_MODE    0x64
+#define CHARGING_LIMIT   0x65
+// Supported by Aero 14 W
+#define FAN_CUSTOM_MODE  0x67
+#define FAN_INDEX_VALUE  0x68
+#define FAN_FIXED_MODE   0x6A
+#define FAN_CUSTOM_SPEED 0x6B
+#define BATT_CYCLE2      0x6D
+#define BATT_CYCLE       0x6E
+#define FAN_AUTO_MODE    0x70
+#define FAN_GAMING_MODE  0x71
+#define USB_SLEEP        0x7A
+#define USB_HIBERNATE    0x7B
+#define WIFI_TOGGLE      0xC2
+#define TOUCHPAD_ENABLED 0xCA
+#define TEMP_CPU         0xE1
+#define TEMP_GPU         0xE2
+#define TEMP_GPU2        0xE3
+#define FAN_CPU_RPM      0xE4
+#define FAN_GPU_RPM      0xE5
+#define FAN_THREE_RPM    0xE8 // 2023 AORUS 17
+#define FAN_FOUR_RPM     0xE9 // 2023 AORUS 17X
+#define FAN_SILENT_OLD   0xFA // Older Aero and P-series models
+
+/* EC registers and commands */
+#define EC_FAN_CONTROL   0x0D // GFAN, bit 0, is auto-maximum mode. Bit 7 is TENF, custom mode.
+#define EC_FAN1_SPEED    0xB0
+#define EC_FAN2_SPEED    0xB1
+
+// Custom fan speeds, in percent
+#define FAN_SPEED_MIN    25
+#define FAN_SPEED_STEP   5
+#define FAN_DUTY_MAX     0xE5
+
+// Fan curves
+#define FAN_CURVE_POINTS 15
+
+/* Fan speeds */
+
+/*
+ * EC duty values for each custom fan speed, from 25 to 100 percent in steps
+ * of five. They follow duty = speed * 0xE5 / 100, rounded down.
+ */
+static const u8 fan_speed_duty[] = {
+	0x39, 0x44, 0x50, 0x5B, 0x67, 0x72, 0x7D, 0x89,
+	0x94, 0xA0, 0xAB, 0xB7, 0xC2, 0xCE, 0xD9, 0xE5
+};
+
+static inline bool fan_speed_valid(unsigned int speed)
+{
+	return speed >= FAN_SPEED_MIN && speed <= 100 && !(speed % FAN_SPEED_STEP);
+}
+
+static inline u8 fan_speed_to_duty(int speed)
+{
+	return fan_speed_duty[(speed - FAN_SPEED_MIN) / FAN_SPEED_STEP];
+}
+
+static inline int fan_duty_to_speed(int duty)
+{
+	for (int i = 0; i < ARRAY_SIZE(fan_speed_duty); i++)
+		if (duty == fan_speed_duty[i])
+			return FAN_SPEED_MIN + i * FAN_SPEED_STEP;
+
+	// For something like 0x5D, which is unknown
+	return 40;
+}
+
+/*
+ * Helper method. Reverses byte order of fan RPM.
+ * This is needed, since the embedded controller stores the value in big-endian
+ * while x86 is little-endian.
+ */
+static inline u16 convert_fan_rpm(int val)
+{
+	u16 fan_rpm = val;
+	return rol16(fan_rpm, 8);
+}
+
+/* Fan modes */
+
+static u8 fan_modes[] = {
+	0,
+	FAN_SILENT_MODE,
+	FAN_GAMING_MODE,
+	FAN_CUSTOM_MODE,
+	FAN_AUTO_MODE,
+	FAN_FIXED_MODE
+};
+
+/*
+ * One WMBD call of a fan mode switch: turn the method of fan_modes[mode] on
+ * or off. Auto mode is turned on with the custom fan speed instead.
+ */
+struct fan_mode_op {
+	u8 mode;
+	u8 on;
+};
+
+#define FAN_MODE_OPS 3
+
+#define SILENT(on) { 1, on }
+#define GAMING(on) { 2, on }
+#define CUSTOM(on) { 3, on }
+#define AUTO       { 4, 1 }
+#define FIXED(on)  { 5, on }
+
+/*
+ * Shortest WMBD sequence for every switch, indexed by current and new mode.
+ * Auto and fixed mode need custom mode on. Silent and gaming mode also turn
+ * auto-maximum mode off, which is the only way to turn it off.
+ */
+static const struct fan_mode_op fan_mode_plans[][ARRAY_SIZE(fan_modes)][FAN_MODE_OPS] = {
+	{ // Normal
+		{ },
+		{ SILENT(1) },
+		{ GAMING(1) },
+		{ CUSTOM(1) },
+		{ CUSTOM(1), AUTO },
+		{ CUSTOM(1), FIXED(1) },
+	},
+	{ // Silent
+		{ SILENT(0) },
+		{ },
+		{ SILENT(0), GAMING(1) },
+		{ SILENT(0), CUSTOM(1) },
+		{ SILENT(0), CUSTOM(1), AUTO },
+		{ SILENT(0), CUSTOM(1), FIXED(1) },
+	},
+	{ // Gaming
+		{ GAMING(0) },
+		{ GAMING(0), SILENT(1) },
+		{ },
+		{ GAMING(0), CUSTOM(1) },
+		{ GAMING(0), CUSTOM(1), AUTO },
+		{ GAMING(0), CUSTOM(1), FIXED(1) },
+	},
+	{ // Custom
+		{ CUSTOM(0) },
+		{ CUSTOM(0), SILENT(1) },
+		{ CUSTOM(0), GAMING(1) },
+		{ },
+		{ AUTO },
+		{ FIXED(1) },
+	},
+	{ // Auto
+		{ GAMING(0), CUSTOM(0) },
+		{ SILENT(1), CUSTOM(0) },
+		{ GAMING(1), CUSTOM(0) },
+		{ GAMING(0) },
+		{ },
+		{ GAMING(0), FIXED(1) },
+	},
+	{ // Fixed
+		{ FIXED(0), CUSTOM(0) },
+		{ FIXED(0), CUSTOM(0), SILENT(1) },
+		{ FIXED(0), CUSTOM(0), GAMING(1) },
+		{ FIXED(0) },
+		{ FIXED(0), AUTO },
+		{ },
+	},
+};
+static_assert(ARRAY_SIZE(fan_mode_plans) == ARRAY_SIZE(fan_modes));
+
+#undef SILENT
+#undef GAMING
+#undef CUSTOM
+#undef AUTO
+#undef FIXED
+
+/*
+ * Call number i of a switch between two fan modes, as a WMBD method and its
+ * argument. Returns false once the switch is complete.
+ */
+static inline bool fan_mode_plan_call(int from, int to, int i, u8 custom_speed,
+					u8 *method, u32 *arg)
+{
+	const struct fan_mode_op *op;
+
+	if (i >= FAN_MODE_OPS)
+		return false;
+	op = &fan_mode_plans[from][to][i];
+	if (!op->mode)
+		return false;
+
+	*method = fan_modes[op->mode];
+	*arg = *method == FAN_AUTO_MODE ? custom_speed : op->on;
+	return true;
+}
+
+/* Firmware sequences */
+
+/*
+ * Firmware access used by the sequences below. The driver passes its WMI and
+ * EC accessors, and the tests pass the emulator. wmbc and wmbd return 0 or a
+ * negative errno, and the integer the method returned in result. ec_read
+ * reads count registers in one call, the ones listed in regs, or the ones
+ * starting at start if regs is NULL.
+ */
+struct gigabyte_laptop_fw_ops {
+	int (*wmbc)(void *data, u8 method, u32 arg, int *result);
+	int (*wmbd)(void *data, u8 method, u32 arg, int *result);
+	int (*ec_read)(void *data, u8 start, const u8 *regs, u8 *buf, int count);
+	int (*ec_write)(void *data, u8 reg, u8 val);
+};
+
+static inline int gigabyte_laptop_switch_fan_mode(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, int from, int to, u8 custom_speed)
+{
+	int ret, result;
+	u8 method;
+	u32 arg;
+
+	for (int i = 0; fan_mode_plan_call(from, to, i, custom_speed, &method, &arg); i++) {
+		ret = fw->wmbd(data, method, arg, &result);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Older devices are using a different method ID for silent fan mode. Newer
+ * devices return nothing or -1 when using that ID, older ones return 0.
+ */
+static inline u8 gigabyte_laptop_probe_silent_method(const struct gigabyte_laptop_fw_ops *fw,
+					void *data)
+{
+	int ret, result;
+
+	ret = fw->wmbc(data, FAN_SILENT_OLD, 0, &result);
+	return ret || result < 0 ? FAN_SILENT_MODE : FAN_SILENT_OLD;
+}
+
+/*
+ * Read back the fan mode, numbered like fan_modes. Auto-maximum mode can't be
+ * read through WMI, so its GFAN bit is taken from the EC. If every check
+ * returns 0, the fans are most likely in normal mode.
+ */
+static inline int gigabyte_laptop_read_fan_mode(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, u8 silent_method, int *mode)
+{
+	int ret, result;
+	u8 fan_control;
+
+	ret = fw->wmbc(data, silent_method, 0, &result);
+	if (ret)
+		return ret;
+	if (result) {
+		*mode = 1;
+		return 0;
+	}
+
+	ret = fw->wmbc(data, FAN_GAMING_MODE, 0, &result);
+	if (ret)
+		return ret;
+	if (result) {
+		*mode = 2;
+		return 0;
+	}
+
+	ret = fw->wmbc(data, FAN_CUSTOM_MODE, 0, &result);
+	if (ret)
+		return ret;
+	if (!result) {
+		*mode = 0;
+		return 0;
+	}
+
+	ret = fw->ec_read(data, EC_FAN_CONTROL, NULL, &fan_control, 1);
+	if (ret)
+		return ret;
+	if (fan_control & BIT(0)) {
+		*mode = 4;
+		return 0;
+	}
+
+	ret = fw->wmbc(data, FAN_FIXED_MODE, 0, &result);
+	if (ret)
+		return ret;
+	*mode = result ? 5 : 3;
+	return 0;
+}
+
+/*
+ * What the driver reads from the firmware at probe, before anything is
+ * exposed. Set charge to read the charging state too. It is cleared when
+ * the firmware turns out not to have charging control.
+ */
+struct gigabyte_laptop_probe_state {
+	u8 silent_method;
+	int fan_mode;
+	u8 custom_speed; // EC duty, 0 if unknown
+	bool charge;
+	int charge_mode;
+	int charge_limit; // 0 if unknown
+};
+
+static inline int gigabyte_laptop_probe_state(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, struct gigabyte_laptop_probe_state *state)
+{
+	int ret, result;
+
+	state->silent_method = gigabyte_laptop_probe_silent_method(fw, data);
+	ret = gigabyte_laptop_read_fan_mode(fw, data, state->silent_method, &state->fan_mode);
+	if (ret)
+		return ret;
+
+	ret = fw->wmbc(data, FAN_CUSTOM_SPEED, 0, &result);
+	if (ret)
+		return ret;
+	state->custom_speed = result;
+
+	if (!state->charge)
+		return 0;
+
+	// Models that are not listed as lacking charging control may still do.
+	ret = fw->wmbc(data, CHARGING_MODE, 0, &result);
+	if (ret == -ENODATA || ret == -EPROTO) {
+		state->charge = false;
+		return 0;
+	}
+	if (ret)
+		return ret;
+	state->charge_mode = result >> 2;
+
+	ret = fw->wmbc(data, CHARGING_LIMIT, 0, &result);
+	if (ret)
+		return ret;
+	state->charge_limit = result;
+	return 0;
+}
+
+/*
+ * Some newer models don't change both fans' speed together through
+ * FAN_CUSTOM_SPEED. If this is the case, we will have to modify FAN2
+ * directly using ec_write. Doing it through WMI would be better if we did
+ * not also have to modify GFTY as well, which already changes on its own
+ * without us doing anything. The custom speed is put back afterwards.
+ */
+static inline bool gigabyte_laptop_probe_dual_fan(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, u8 custom_speed)
+{
+	u8 speeds[2] = { 0 };
+	int result;
+
+	fw->wmbd(data, FAN_CUSTOM_SPEED, 255, &result);
+	fw->ec_read(data, EC_FAN1_SPEED, NULL, speeds, 2);
+	fw->wmbd(data, FAN_CUSTOM_SPEED, custom_speed, &result);
+	return speeds[0] != speeds[1];
+}
+
+/* Sensors */
+
+#define TEMP_CHANNELS 4
+#define FAN_CHANNELS  4
+
+/*
+ * EC offsets backing the WMBC sensor methods on a given model. Temperatures
+ * are one byte, fan RPMs are two bytes stored big-endian starting at the
+ * given offset. An offset of 0 means the channel is read through WMI.
+ */
+struct gigabyte_laptop_ec_map {
+	u8 temp[TEMP_CHANNELS];
+	u8 fan[FAN_CHANNELS];
+};
+
+struct gigabyte_laptop_sensors {
+	long temp[TEMP_CHANNELS];
+	long fan[FAN_CHANNELS];
+	int temp_ret[TEMP_CHANNELS];
+	int fan_ret[FAN_CHANNELS];
+	u64 timestamp;
+};
+
+// WMBC methods backing each channel. Motherboard temp cannot be read through WMI.
+static const u8 temp_methods[TEMP_CHANNELS] = { TEMP_CPU, TEMP_GPU, 0, TEMP_GPU2 };
+static const u8 fan_methods[FAN_CHANNELS] = {
+	FAN_CPU_RPM, FAN_GPU_RPM, FAN_THREE_RPM, FAN_FOUR_RPM
+};
+
+static inline int gigabyte_laptop_read_temp_channel(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, const struct gigabyte_laptop_ec_map *map,
+					int channel, long *val)
+{
+	int ret, output;
+	u8 result;
+
+	if (map->temp[channel]) {
+		ret = fw->ec_read(data, map->temp[channel], NULL, &result, 1);
+		if (ret)
+			return ret;
+		*val = result * 1000;
+		return 0;
+	}
+
+	if (!temp_methods[channel])
+		return -ENODATA;
+
+	ret = fw->wmbc(data, temp_methods[channel], 0, &output);
+	if (ret)
+		return ret;
+	*val = output * 1000;
+	return 0;
+}
+
+static inline int gigabyte_laptop_read_fan_channel(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, const struct gigabyte_laptop_ec_map *map,
+					int channel, long *val)
+{
+	int ret, output;
+	u8 rpm[2];
+
+	if (map->fan[channel]) {
+		ret = fw->ec_read(data, map->fan[channel], NULL, rpm, 2);
+		if (ret)
+			return ret;
+		*val = rpm[0] << 8 | rpm[1];
+		return 0;
+	}
+
+	ret = fw->wmbc(data, fan_methods[channel], 0, &output);
+	if (ret)
+		return ret;
+	*val = convert_fan_rpm(output);
+	return 0;
+}
+
+/*
+ * Read the present channels into sample, fetching every EC-backed one in a
+ * single ec_read call. Channels that fail keep their last good value, and
+ * their error goes to temp_ret or fan_ret.
+ */
+static inline void gigabyte_laptop_read_sensors(const struct gigabyte_laptop_fw_ops *fw,
+					void *data, const struct gigabyte_laptop_ec_map *map,
+					u8 temp_present, u8 fan_present,
+					struct gigabyte_laptop_sensors *sample)
+{
+	u8 regs[TEMP_CHANNELS + 2 * FAN_CHANNELS];
+	u8 values[ARRAY_SIZE(regs)];
+	int count = 0, ec_ret = 0;
+	long val;
+	int ret;
+
+	for (int i = 0; i < TEMP_CHANNELS; i++)
+		if (temp_present & BIT(i) && map->temp[i])
+			regs[count++] = map->temp[i];
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		if (fan_present & BIT(i) && map->fan[i]) {
+			regs[count++] = map->fan[i];
+			regs[count++] = map->fan[i] + 1;
+		}
+	}
+	if (count)
+		ec_ret = fw->ec_read(data, 0, regs, values, count);
+
+	count = 0;
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		if (!(temp_present & BIT(i)))
+			continue;
+		if (map->temp[i]) {
+			ret = ec_ret;
+			val = values[count++] * 1000;
+		} else {
+			ret = gigabyte_laptop_read_temp_channel(fw, data, map, i, &val);
+		}
+		sample->temp_ret[i] = ret;
+		if (!ret)
+			sample->temp[i] = val;
+	}
+
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		if (!(fan_present & BIT(i)))
+			continue;
+		if (map->fan[i]) {
+			ret = ec_ret;
+			val = values[count] << 8 | values[count + 1];
+			count += 2;
+		} else {
+			ret = gigabyte_laptop_read_fan_channel(fw, data, map, i, &val);
+		}
+		sample->fan_ret[i] = ret;
+		if (!ret)
+			sample->fan[i] = val;
+	}
+}
+
+/* Fan curves */
+
+// likely payload: speed, temp, index
+static inline u32 fan_curve_payload(u8 index, u8 temperature, u8 speed)
+{
+	return speed << 16 | temperature << 8 | index;
+}
+
+// A point as WMBC FAN_INDEX_VALUE returns it, and fan_curve_data takes it.
+static inline u16 fan_curve_point(u8 temperature, u8 speed)
+{
+	return speed << 8 | temperature;
+}
+
+static inline void fan_curve_point_unpack(u16 point, u8 *temperature, u8 *speed)
+{
+	*temperature = point;
+	*speed = point >> 8;
+}
+
+#endif
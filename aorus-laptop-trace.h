@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  aorus-laptop-trace.h - Tracepoints of the AORUS laptop WMI driver
+ *
+ *  Copyright (C) 2023 Albert Tang
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aorus_laptop
+
+#if !defined(_AORUS_LAPTOP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AORUS_LAPTOP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// One WMBC or WMBD evaluation. value is the integer returned, if any.
+TRACE_EVENT(aorus_laptop_wmi,
+	TP_PROTO(u8 guid, u32 method, u32 arg, u32 status, int ret, u64 value,
+		u64 duration, unsigned long caller),
+
+	TP_ARGS(guid, method, arg, status, ret, value, duration, caller),
+
+	TP_STRUCT__entry(
+		__field(u8, guid)
+		__field(u32, method)
+		__field(u32, arg)
+		__field(u32, status)
+		__field(int, ret)
+		__field(u64, value)
+		__field(u64, duration)
+		__field(unsigned long, caller)
+	),
+
+	TP_fast_assign(
+		__entry->guid = guid;
+		__entry->method = method;
+		__entry->arg = arg;
+		__entry->status = status;
+		__entry->ret = ret;
+		__entry->value = value;
+		__entry->duration = duration;
+		__entry->caller = caller;
+	),
+
+	TP_printk("%s method=0x%02x arg=0x%x status=0x%x ret=%d value=0x%llx duration=%lluns caller=%pS",
+		__print_symbolic(__entry->guid, { 0, "WMBC" }, { 1, "WMBD" }),
+		__entry->method, __entry->arg, __entry->status, __entry->ret,
+		__entry->value, __entry->duration, (void *)__entry->caller)
+);
+
+// One direct EC access. Block reads report their first register and byte.
+TRACE_EVENT(aorus_laptop_ec,
+	TP_PROTO(bool write, u8 reg, int count, u8 value, int ret, u64 duration,
+		unsigned long caller),
+
+	TP_ARGS(write, reg, count, value, ret, duration, caller),
+
+	TP_STRUCT__entry(
+		__field(bool, write)
+		__field(u8, reg)
+		__field(int, count)
+		__field(u8, value)
+		__field(int, ret)
+		__field(u64, duration)
+		__field(unsigned long, caller)
+	),
+
+	TP_fast_assign(
+		__entry->write = write;
+		__entry->reg = reg;
+		__entry->count = count;
+		__entry->value = value;
+		__entry->ret = ret;
+		__entry->duration = duration;
+		__entry->caller = caller;
+	),
+
+	TP_printk("%s reg=0x%02x count=%d value=0x%02x ret=%d duration=%lluns caller=%pS",
+		__entry->write ? "write" : "read", __entry->reg, __entry->count,
+		__entry->value, __entry->ret, __entry->duration, (void *)__entry->caller)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aorus-laptop-trace
+#include <trace/define_trace.h>
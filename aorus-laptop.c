@@ -8,14 +8,40 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/acpi.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/dmi.h>
 #include <linux/hwmon.h>
 #include <linux/hwmon-sysfs.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/platform_device.h>
+#include <linux/platform_profile.h>
+#include <linux/poll.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/thermal.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
 #include <linux/wmi.h>
+#include <linux/workqueue.h>
+#include <net/genetlink.h>
+
+#include "aorus-laptop.h"
+#include "aorus-laptop-core.h"
+
+#define CREATE_TRACE_POINTS
+#include "aorus-laptop-trace.h"
 
 #define GIGABYTE_LAPTOP_VERSION "0.01"
 #define GIGABYTE_LAPTOP_FILE  KBUILD_MODNAME
@@ -25,51 +51,158 @@ MODULE_DESCRIPTION("Gigabyte laptop WMI driver");
 MODULE_LICENSE("GPL");
 MODULE_VERSION(GIGABYTE_LAPTOP_VERSION);
 
+static unsigned int update_interval = 1000;
+module_param(update_interval, uint, 0444);
+MODULE_PARM_DESC(update_interval, "Time in milliseconds between sensor samples (default: 1000)");
+
+static bool ec_fast_path = true;
+module_param(ec_fast_path, bool, 0444);
+MODULE_PARM_DESC(ec_fast_path, "Read sensors directly from the EC when the model allows it (default: true)");
+
+static bool blocking_writes;
+module_param(blocking_writes, bool, 0644);
+MODULE_PARM_DESC(blocking_writes, "Wait for sysfs writes to reach the EC before returning (default: false)");
+
 /* _SB_.PCI0.AMW0._WDG */
-#define WMI_EVENT "ABBC0F72-8EA1-11D1-00A0-C90629100000" // Hopefully, it's used for hotkeys
+#define WMI_EVENT "ABBC0F72-8EA1-11D1-00A0-C90629100000" // Hotkeys, Notify (AMW0, 0xD2)
 #define WMI_METHOD_WMBC "ABBC0F6F-8EA1-11D1-00A0-C90629100000" // Seems to only return values
 #define WMI_METHOD_WMBD "ABBC0F75-8EA1-11D1-00A0-C90629100000" // Will probably do most of the work.
 
-/* WMI method arguments */
-// Not supported by Aero 14 W
-#define GPU_QBOOST       0x51
-#define FAN_SILENT_MODE  0x57
-#define CHARGING_MODE    0x64
-#define CHARGING_LIMIT   0x65
-// Supported by Aero 14 W
-#define FAN_CUSTOM_MODE  0x67
-#define FAN_INDEX_VALUE  0x68
-#define FAN_FIXED_MODE   0x6A
-#define FAN_CUSTOM_SPEED 0x6B
-#define BATT_CYCLE2      0x6D
-#define BATT_CYCLE       0x6E
-#define FAN_AUTO_MODE    0x70
-#define FAN_GAMING_MODE  0x71
-#define USB_SLEEP        0x7A
-#define USB_HIBERNATE    0x7B
-#define WIFI_TOGGLE      0xC2
-#define TOUCHPAD_ENABLED 0xCA
-#define TEMP_CPU         0xE1
-#define TEMP_GPU         0xE2
-#define FAN_CPU_RPM      0xE4
-#define FAN_GPU_RPM      0xE5
-#define FAN_THREE_RPM    0xE8 // 2023 AORUS 17
-#define FAN_FOUR_RPM     0xE9 // 2023 AORUS 17X
-#define FAN_SILENT_OLD   0xFA // Older Aero and P-series models
-
-// Fan curves
-#define FAN_CURVE_POINTS 15
+#define FAN_CONTROL_POINTS 16
 
 struct fan_curve_data {
 	u8 temperature[FAN_CURVE_POINTS];
 	u8 speed[FAN_CURVE_POINTS];
 };
 
+// Features missing on some models, see gigabyte_laptop_known_working_platforms.
+#define GIGABYTE_LAPTOP_CAP_CHARGE    BIT(0)
+#define GIGABYTE_LAPTOP_CAP_GPU_BOOST BIT(1)
+#define GIGABYTE_LAPTOP_CAPS_ALL      (GIGABYTE_LAPTOP_CAP_CHARGE | GIGABYTE_LAPTOP_CAP_GPU_BOOST)
+
+// Telemetry history, over 100 seconds at the shortest update interval.
+#define TELEMETRY_RECORDS 1024
+
+// Fans that can be thermal cooling devices: FAN1 (CPU), and FAN2 (GPU) on dual fan models.
+#define COOLING_FANS 2
+
+// Sensors
+#define TEMP_MOTHERBOARD 2
+
+// State sent to netlink subscribers when it changes.
+struct gigabyte_laptop_state {
+	int fan_mode;
+	int fan_custom_speed;
+	int charge_mode;
+	int charge_limit;
+	int gpu_boost;
+};
+
+// Beyond CPU and GPU, the sensor channels listed here are kept even at 0.
+struct gigabyte_laptop_model {
+	const struct gigabyte_laptop_ec_map *ec_map;
+	unsigned long caps;
+	u8 temp_channels;
+	u8 fan_channels;
+};
+
+// Curve of the in-driver fan controller, speeds in percent.
+struct fan_control_data {
+	int points;
+	u8 temperature[FAN_CONTROL_POINTS];
+	u8 speed[FAN_CONTROL_POINTS];
+};
+
+/*
+ * Queued sysfs writes, in the order they are applied. State changed by the
+ * firmware is refreshed first, so writes are applied on top of it. The
+ * custom speed and fan curve go before the fan mode, so a mode written with
+ * them starts out with the new values.
+ */
+enum gigabyte_laptop_command {
+	CMD_REFRESH,
+	CMD_FAN_SPEED,
+	CMD_FAN_DUTY,
+	CMD_COOLING,
+	CMD_FAN_CURVE,
+	CMD_FAN_MODE,
+	CMD_CHARGE_MODE,
+	CMD_CHARGE_LIMIT,
+	CMD_GPU_BOOST,
+	CMD_COUNT,
+};
+
+struct gigabyte_laptop_cooling {
+	struct gigabyte_laptop_wmi *gigabyte;
+	struct thermal_cooling_device *cdev;
+	unsigned long state; // 0 = EC managed, or a step of fan_speed_duty plus one
+	u8 duty; // Last duty written, 0 if none
+};
+
 struct gigabyte_laptop_wmi {
 	struct platform_device *pdev;
 	struct device *hwmon_dev;
 	struct fan_curve_data fan_curve;
+	struct gigabyte_laptop_sensors sensors;
+	seqlock_t sensor_seqlock;
+	struct delayed_work sensor_work;
+	struct work_struct probe_work;
+	const struct gigabyte_laptop_model *model;
+	struct gigabyte_laptop_ec_map ec_map;
+	struct page *status_page;
+	struct aorus_laptop_status *status;
+	spinlock_t status_lock;
+	struct gigabyte_laptop_state netlink_state;
+	struct dentry *debugfs;
+
+	spinlock_t telemetry_lock;
+	wait_queue_head_t telemetry_wait;
+	struct aorus_laptop_record *telemetry;
+	u64 telemetry_head;
+	bool telemetry_closed;
+	u8 temp_present;
+	u8 fan_present;
+	u32 temp_config[TEMP_CHANNELS + 1];
+	u32 fan_config[FAN_CHANNELS + 1];
+	struct hwmon_channel_info temp_info;
+	struct hwmon_channel_info fan_info;
+	const struct hwmon_channel_info *hwmon_info[4];
+	struct hwmon_chip_info chip_info;
+
+	spinlock_t cmd_lock;
+	struct work_struct cmd_work;
+	unsigned long cmd_pending;
+	int cmd_value[CMD_COUNT];
+	unsigned long cmd_caller[CMD_COUNT]; // Where each command was queued, for the trace
+	struct fan_curve_data cmd_curve;
+	int cmd_error;
+
+	spinlock_t fan_control_lock;
+	struct fan_control_data fan_control;
+	bool fan_control_enabled;
+	int fan_control_hysteresis;
+	int fan_control_ramp;
+	int fan_control_saved_mode;
+	int fan_control_saved_speed;
+	long fan_control_temp;
+	int fan_control_speed;
+	u8 fan_control_duty;
+
+	struct gigabyte_laptop_cooling cooling[COOLING_FANS];
+	bool cooling_active;
+	int cooling_saved_mode;
+
+	// Platform profile device, only used under profile_lock.
+	struct mutex profile_lock;
+	struct device *ppdev;
 
+	/*
+	 * Cached state. Everything that changes it, and every multi-step EC
+	 * sequence, runs under state_lock. Readers never take it: single
+	 * values are read with READ_ONCE, the fan curve through state_seq.
+	 */
+	struct mutex state_lock;
+	seqcount_mutex_t state_seq;
 	int fan_mode;
 	int fan_custom_display_speed;
 	int fan_custom_internal_speed;
@@ -77,6 +210,7 @@ struct gigabyte_laptop_wmi {
 	int charge_limit;
 	int gpu_boost;
 	int fan_curve_index;
+	unsigned int update_interval;
 
 	u8 fan_silent_method;
 	u8 debug_method;
@@ -84,831 +218,2922 @@ struct gigabyte_laptop_wmi {
 };
 
 static struct platform_device *platform_device;
+static DEFINE_MUTEX(gigabyte_laptop_bind_lock);
+
+/* Statistics *********************************************/
 
-static u8 fan_modes[] = {
-	0,
-	FAN_SILENT_MODE,
-	FAN_GAMING_MODE,
-	FAN_CUSTOM_MODE,
-	FAN_AUTO_MODE,
-	FAN_FIXED_MODE
+/*
+ * Call counts and log2 latency histograms of every WMI method the driver
+ * knows, per GUID, and of the direct EC accesses. Other method IDs (from
+ * debug_method) share one row. Counters are per CPU, so recording a call
+ * never bounces a cache line, and are summed when debugfs is read.
+ */
+static const u8 gigabyte_laptop_stats_methods[] = {
+	GPU_QBOOST, FAN_SILENT_MODE, CHARGING_MODE, CHARGING_LIMIT,
+	FAN_CUSTOM_MODE, FAN_INDEX_VALUE, FAN_FIXED_MODE, FAN_CUSTOM_SPEED,
+	BATT_CYCLE2, BATT_CYCLE, FAN_AUTO_MODE, FAN_GAMING_MODE,
+	USB_SLEEP, USB_HIBERNATE, WIFI_TOGGLE, TOUCHPAD_ENABLED,
+	TEMP_CPU, TEMP_GPU, TEMP_GPU2, FAN_CPU_RPM,
+	FAN_GPU_RPM, FAN_THREE_RPM, FAN_FOUR_RPM, FAN_SILENT_OLD,
 };
 
-/* WMI methods ********************************************/
+#define STATS_METHODS  (ARRAY_SIZE(gigabyte_laptop_stats_methods) + 1) // Last one is "other"
+#define STATS_WMI_GUIDS 2 // WMBC and WMBD
+#define STATS_EC_READ  (STATS_WMI_GUIDS * STATS_METHODS)
+#define STATS_EC_WRITE (STATS_EC_READ + 1)
+#define STATS_SLOTS    (STATS_EC_WRITE + 1)
+#define STATS_BUCKETS  32 // Bucket i holds durations of [2^i, 2^(i+1)) ns
+
+struct gigabyte_laptop_stat {
+	u64 calls;
+	u64 errors;
+	u64 total_ns;
+	u32 histogram[STATS_BUCKETS];
+};
 
-/* WMBC method (checks value in EC) */
-static int gigabyte_laptop_get_devstate2(u32 method_id, u32 arg2, int *result)
-{
-	union acpi_object *obj;
-	acpi_status status;
-	struct acpi_buffer buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	struct acpi_buffer input = { sizeof(arg2), &arg2 };
+struct gigabyte_laptop_stats {
+	struct gigabyte_laptop_stat slot[STATS_SLOTS];
+};
 
-	status = wmi_evaluate_method(WMI_METHOD_WMBC, 0, method_id, &input, &buffer);
-	if (ACPI_FAILURE(status))
-		return -1;
-
-	obj = buffer.pointer;
-	if (obj && obj->type == ACPI_TYPE_INTEGER)
-		*result = obj->integer.value;
-	else if (obj && obj->type == ACPI_TYPE_BUFFER) {
-		if (obj->buffer.length == 0) {
-			kfree(obj);
-			return -ENODATA;
-		}
-		pr_info("This works\n");
-		pr_info("ACPI buffer length: %u\n", obj->buffer.length);
-		pr_info("ACPI buffer contents: \n");
+static struct gigabyte_laptop_stats __percpu *gigabyte_laptop_stats;
 
-		for (int i = 0; i < obj->buffer.length; i++) {
-			pr_info("%02x \n", obj->buffer.pointer[i]);
-		}
-		//memcpy(result, obj->buffer.pointer, obj->buffer.length);
-	}
-	else {
-		kfree(obj);
-		return -EINVAL;
-	}
-	kfree(obj);
-	return 0;
+static int gigabyte_laptop_stats_wmi_slot(int guid, u32 method_id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gigabyte_laptop_stats_methods); i++)
+		if (gigabyte_laptop_stats_methods[i] == method_id)
+			break;
+	return guid * STATS_METHODS + i;
 }
 
-static int gigabyte_laptop_get_devstate(u32 method_id, int *result) {
-	return gigabyte_laptop_get_devstate2(method_id, 0, result);
+static void gigabyte_laptop_stats_add(int slot, u64 duration, int ret)
+{
+	struct gigabyte_laptop_stat *stat;
+
+	stat = &get_cpu_ptr(gigabyte_laptop_stats)->slot[slot];
+	stat->calls++;
+	if (ret)
+		stat->errors++;
+	stat->total_ns += duration;
+	stat->histogram[min(ilog2(duration | 1), STATS_BUCKETS - 1)]++;
+	put_cpu_ptr(gigabyte_laptop_stats);
 }
 
-/* WMBD method (sets value in EC) */
-static int gigabyte_laptop_set_devstate(u32 method_id, u32 arg2, int *result)
+static void gigabyte_laptop_stats_show_slot(struct seq_file *m, const char *name, int slot)
 {
-	union acpi_object *obj;
-	acpi_status status;
-	struct acpi_buffer buffer = { ACPI_ALLOCATE_BUFFER, NULL };
-	struct acpi_buffer input = { sizeof(arg2), &arg2 };
+	struct gigabyte_laptop_stat sum = {};
+	int cpu, i;
 
-	status = wmi_evaluate_method(WMI_METHOD_WMBD, 0, method_id, &input, &buffer);
-	if (ACPI_FAILURE(status))
-		return -1;
+	for_each_possible_cpu(cpu) {
+		const struct gigabyte_laptop_stat *stat = &per_cpu_ptr(gigabyte_laptop_stats, cpu)->slot[slot];
 
-	obj = buffer.pointer;
-	if (obj && obj->type == ACPI_TYPE_INTEGER)
-		*result = obj->integer.value;
-	else {
-		kfree(obj);
-		return -EINVAL;
+		sum.calls += stat->calls;
+		sum.errors += stat->errors;
+		sum.total_ns += stat->total_ns;
+		for (i = 0; i < STATS_BUCKETS; i++)
+			sum.histogram[i] += stat->histogram[i];
 	}
-	kfree(obj);
-	return 0;
+	if (!sum.calls)
+		return;
+
+	seq_printf(m, "%s: calls %llu errors %llu avg %lluns\n", name, sum.calls,
+		sum.errors, div64_u64(sum.total_ns, sum.calls));
+	for (i = 0; i < STATS_BUCKETS; i++)
+		if (sum.histogram[i])
+			seq_printf(m, "  %10lluns %u\n", 1ULL << i, sum.histogram[i]);
 }
 
-/* hwmon **************************************************/
-
-/*
- * Helper method. Reverses byte order of fan RPM.
- * This is needed, since the embedded controller stores the value in big-endian
- * while x86 is little-endian.
- */
-static u16 convert_fan_rpm(int val)
+static int gigabyte_laptop_stats_show(struct seq_file *m, void *v)
 {
-	u16 fan_rpm = val;
-	return rol16(fan_rpm, 8);
+	static const char * const guids[STATS_WMI_GUIDS] = { "WMBC", "WMBD" };
+	char name[16];
+	int guid, i;
+
+	for (guid = 0; guid < STATS_WMI_GUIDS; guid++) {
+		for (i = 0; i < STATS_METHODS; i++) {
+			if (i < ARRAY_SIZE(gigabyte_laptop_stats_methods))
+				snprintf(name, sizeof(name), "%s 0x%02x", guids[guid],
+					gigabyte_laptop_stats_methods[i]);
+			else
+				snprintf(name, sizeof(name), "%s other", guids[guid]);
+			gigabyte_laptop_stats_show_slot(m, name, guid * STATS_METHODS + i);
+		}
+	}
+	gigabyte_laptop_stats_show_slot(m, "EC read", STATS_EC_READ);
+	gigabyte_laptop_stats_show_slot(m, "EC write", STATS_EC_WRITE);
+	return 0;
 }
 
-static umode_t gigabyte_laptop_hwmon_is_visible(const void *data, enum hwmon_sensor_types type,
-					u32 attr, int channel)
+static int gigabyte_laptop_stats_open(struct inode *inode, struct file *file)
 {
-	switch (type) {
-		case hwmon_temp:
-			switch (attr) {
-				case hwmon_temp_input:
-					return 0444;
-				default:
-					break;
-			}
-			break;
-		case hwmon_fan:
-			switch (attr) {
-				case hwmon_fan_input:
-					return 0444;
-				default:
-					break;
-			}
-			break;
-		default:
-			break;
-	}
-	return 0;
+	return single_open(file, gigabyte_laptop_stats_show, NULL);
 }
 
-static int gigabyte_laptop_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
-					u32 attr, int channel, long *val)
+// Any write clears the counters. Calls running meanwhile may be half counted.
+static ssize_t gigabyte_laptop_stats_write(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	int ret, output;
-	u8 result;
-	u8 fan_channels[] = { FAN_CPU_RPM, FAN_GPU_RPM, FAN_THREE_RPM, FAN_FOUR_RPM };
+	int cpu;
 
-	switch (type) {
-		case hwmon_temp:
-			switch (channel) {
-				case 0:
-					ret = gigabyte_laptop_get_devstate(TEMP_CPU, &output);
-					if (ret)
-						break;
-					*val = output * 1000;
-					break;
-				case 1:
-					ret = gigabyte_laptop_get_devstate(TEMP_GPU, &output);
-					if (ret)
-						break;
-					*val = output * 1000;
-					break;
-				case 2:
-					// Motherboard temp cannot be read through WMI
-					ret = ec_read(0x62, &result);
-					if (ret)
-						break;
-					*val = result * 1000;
-					break;
-				default:
-					*val = 0;
-					break;
-			}
-			break;
-		case hwmon_fan:
-			ret = gigabyte_laptop_get_devstate(fan_channels[channel], &output);
-			if (ret)
-				break;
-			*val = convert_fan_rpm(output);
-			break;
-		default:
-			break;
-	}
-	return 0;
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(gigabyte_laptop_stats, cpu), 0,
+			sizeof(struct gigabyte_laptop_stats));
+	return count;
 }
 
-static const struct hwmon_channel_info *gigabyte_laptop_hwmon_info[] = {
-	HWMON_CHANNEL_INFO(temp,
-				HWMON_T_INPUT,
-				HWMON_T_INPUT,
-				HWMON_T_INPUT),
-	HWMON_CHANNEL_INFO(fan,
-				HWMON_F_INPUT,
-				HWMON_F_INPUT,
-				HWMON_F_INPUT,
-				HWMON_F_INPUT),
-	NULL
+static const struct file_operations gigabyte_laptop_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = gigabyte_laptop_stats_open,
+	.read = seq_read,
+	.write = gigabyte_laptop_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static const struct hwmon_ops gigabyte_laptop_hwmon_ops = {
-	.read = gigabyte_laptop_hwmon_read,
-	.is_visible = gigabyte_laptop_hwmon_is_visible,
-};
+/* Transport **********************************************/
 
-static const struct hwmon_chip_info gigabyte_laptop_chip_info = {
-	.ops = &gigabyte_laptop_hwmon_ops,
-	.info = gigabyte_laptop_hwmon_info,
+enum gigabyte_laptop_guid {
+	GIGABYTE_LAPTOP_WMBC,
+	GIGABYTE_LAPTOP_WMBD,
+	GIGABYTE_LAPTOP_EVENT,
+	GIGABYTE_LAPTOP_GUIDS,
 };
 
-/* sysfs **************************************************/
+static struct wmi_device *gigabyte_laptop_wdev[GIGABYTE_LAPTOP_GUIDS];
 
 /*
- * Fan mode.
- * 0 = normal fan mode
- * 1 = silent fan mode
- * 2 = gaming fan mode
- * 3 = custom fan mode
- * 4 = auto-maximum mode (requires custom mode)
- * 5 = fixed speed mode (requires custom mode)
+ * Everything the driver asks of the firmware goes through these three calls,
+ * so that another backend can stand in for ACPI and the EC.
  */
-static int disable_custom_fan_mode(int mode)
-{
-	int ret, result;
-
-	if (mode == 5) {
-		ret = gigabyte_laptop_set_devstate(FAN_FIXED_MODE, 0, &result);
-		if (ret)
-			return ret;
-	} else if (mode == 4) {
-		// Auto-maximum mode can only be turned off through gaming or silent mode
-		ret = gigabyte_laptop_set_devstate(FAN_GAMING_MODE, 0, &result);
-		if (ret)
-			return ret;
-	}
+struct gigabyte_laptop_transport {
+	acpi_status (*evaluate)(enum gigabyte_laptop_guid guid, u32 method_id,
+				const struct acpi_buffer *in, struct acpi_buffer *out);
+	int (*ec_read)(u8 reg, u8 *val);
+	int (*ec_write)(u8 reg, u8 val);
+};
 
-	ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_MODE, 0, &result);
-	if (ret)
-		return ret;
+static acpi_status gigabyte_laptop_acpi_evaluate(enum gigabyte_laptop_guid guid, u32 method_id,
+				const struct acpi_buffer *in, struct acpi_buffer *out)
+{
+	struct wmi_device *wdev = READ_ONCE(gigabyte_laptop_wdev[guid]);
 
-	return 0;
+	if (!wdev)
+		return AE_NOT_EXIST;
+	return wmidev_evaluate_method(wdev, 0, method_id, in, out);
 }
 
-static int set_fan_mode(struct gigabyte_laptop_wmi *gigabyte, u32 fan_mode)
-{
-	int ret, result;
-
-	if (fan_mode == FAN_FIXED_MODE || fan_mode == FAN_AUTO_MODE) {
-		if (gigabyte->fan_mode < 3) { // If custom mode is off, enable it
-			if (gigabyte->fan_mode > 0) {
-				ret = gigabyte_laptop_set_devstate(fan_modes[gigabyte->fan_mode], 0, &result);
-				if (ret)
-					return ret;
-			}
+static const struct gigabyte_laptop_transport gigabyte_laptop_acpi_transport = {
+	.evaluate = gigabyte_laptop_acpi_evaluate,
+	.ec_read = ec_read,
+	.ec_write = ec_write,
+};
 
-			ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_MODE, 1, &result);
-			if (ret)
-				return ret;
-		}
+static const struct gigabyte_laptop_transport *gigabyte_laptop_transport =
+	&gigabyte_laptop_acpi_transport;
 
-		if (gigabyte->fan_mode > 3) { // Fixed or auto mode active
-			if (gigabyte->fan_mode == 4) {
-				// Auto-maximum mode can only be turned off through gaming or silent mode
-				ret = gigabyte_laptop_set_devstate(FAN_GAMING_MODE, 0, &result);
-				if (ret)
-					return ret;
-			} else {
-				ret = gigabyte_laptop_set_devstate(fan_modes[gigabyte->fan_mode], 0, &result);
-				if (ret)
-					return ret;
-			}
-		}
+/* Recording **********************************************/
 
-		if (fan_mode == FAN_AUTO_MODE) {
-			ret = gigabyte_laptop_set_devstate(fan_mode, gigabyte->fan_custom_internal_speed, &result);
-			if (ret)
-				return ret;
-		} else {
-			ret = gigabyte_laptop_set_devstate(fan_mode, 1, &result);
-			if (ret)
-				return ret;
-		}
-	} else if (fan_mode == FAN_CUSTOM_MODE) {
-		if (gigabyte->fan_mode > 3) {
-			pr_warn("Custom mode is already enabled\n");
-			return 0;
-		} else if (gigabyte->fan_mode > 0) {
-			ret = gigabyte_laptop_set_devstate(fan_modes[gigabyte->fan_mode], 0, &result);
-			if (ret)
-				return ret;
-		}
+/*
+ * Firmware calls can be recorded to debugfs, with their results and latency.
+ * tests/emu-replay replays a recording against the emulated firmware.
+ */
+#define RECORD_CALLS 16384
 
-		ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_MODE, 1, &result);
-		if (ret)
-			return ret;
-	} else {
-		if (gigabyte->fan_mode >= 3) { // Disable custom mode first. Will revert to normal mode.
-			ret = disable_custom_fan_mode(gigabyte->fan_mode);
-			if (ret)
-				return ret;
-		} else if (gigabyte->fan_mode > 0) {
-				ret = gigabyte_laptop_set_devstate(fan_modes[gigabyte->fan_mode], 0, &result);
-				if (ret)
-					return ret;
-		}
+static DEFINE_MUTEX(gigabyte_laptop_record_lock);
+static struct aorus_laptop_call *gigabyte_laptop_record;
+static unsigned int gigabyte_laptop_record_count;
+static bool gigabyte_laptop_recording;
 
-		if (fan_mode != 0) {
-			ret = gigabyte_laptop_set_devstate(fan_mode, 1, &result);
-			if (ret)
-				return ret;
-		}
-	}
-	return 0;
+static void gigabyte_laptop_record_call(const struct aorus_laptop_call *call)
+{
+	mutex_lock(&gigabyte_laptop_record_lock);
+	if (gigabyte_laptop_recording && gigabyte_laptop_record_count < RECORD_CALLS)
+		gigabyte_laptop_record[gigabyte_laptop_record_count++] = *call;
+	mutex_unlock(&gigabyte_laptop_record_lock);
 }
 
-static ssize_t fan_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+/*
+ * Entry points of the driver into the transport. They record the calls, but
+ * only read the clock when recording is on.
+ */
+static acpi_status gigabyte_laptop_evaluate(enum gigabyte_laptop_guid guid, u32 method_id,
+				const struct acpi_buffer *in, struct acpi_buffer *out)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct aorus_laptop_call call = { .type = guid, .method = method_id };
+	bool recording = READ_ONCE(gigabyte_laptop_recording);
+	union acpi_object *obj = out->pointer;
+	u64 start = recording ? ktime_get_ns() : 0;
+	acpi_status status;
 
-	return sysfs_emit(buf, "%d\n", gigabyte->fan_mode);
+	status = READ_ONCE(gigabyte_laptop_transport)->evaluate(guid, method_id, in, out);
+	if (!recording)
+		return status;
+
+	call.duration = min_t(u64, ktime_get_ns() - start, U32_MAX);
+	if (in->length >= sizeof(call.arg))
+		memcpy(&call.arg, in->pointer, sizeof(call.arg));
+	call.status = status;
+	if (ACPI_SUCCESS(status) && out->length) {
+		call.result = obj->type;
+		if (obj->type == ACPI_TYPE_INTEGER) {
+			call.value = obj->integer.value;
+		} else if (obj->type == ACPI_TYPE_BUFFER) {
+			call.length = min_t(u32, obj->buffer.length, U8_MAX);
+			memcpy(&call.value, obj->buffer.pointer,
+				min_t(u32, obj->buffer.length, sizeof(call.value)));
+		}
+	}
+	gigabyte_laptop_record_call(&call);
+	return status;
 }
 
-static ssize_t fan_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+// One EC read or write. val is the byte read or written.
+static int gigabyte_laptop_ec_io(u8 type, u8 reg, u8 *val)
 {
+	const struct gigabyte_laptop_transport *transport = READ_ONCE(gigabyte_laptop_transport);
+	struct aorus_laptop_call call = { .type = type, .method = reg };
+	bool recording = READ_ONCE(gigabyte_laptop_recording);
+	u64 start = recording ? ktime_get_ns() : 0;
 	int ret;
-	unsigned int fan_mode = 0;
-	struct gigabyte_laptop_wmi *gigabyte;
-
-	ret = kstrtouint(buf, 0, &fan_mode);
-	if (ret) {
-		pr_err("kstrtouint failed\n");
-		return count;
-	}
-
-	gigabyte = dev_get_drvdata(dev);
-
-	if (gigabyte->fan_mode == fan_mode) {
-		pr_warn("Already set to that fan mode\n");
-		return count;
-	}
 
-	if (fan_mode > 5) {
-		pr_err("Invalid fan mode\n");
-		return -EINVAL;
+	if (type == AORUS_LAPTOP_CALL_EC_WRITE) {
+		ret = transport->ec_write(reg, *val);
+		call.arg = *val;
 	} else {
-		ret = set_fan_mode(gigabyte, fan_modes[fan_mode]);
-		if (ret)
-			return ret;
+		ret = transport->ec_read(reg, val);
 	}
+	if (!recording)
+		return ret;
 
-	gigabyte->fan_mode = fan_mode;
-	return count;
+	call.duration = min_t(u64, ktime_get_ns() - start, U32_MAX);
+	call.status = ret;
+	if (!ret && type == AORUS_LAPTOP_CALL_EC_READ)
+		call.value = *val;
+	gigabyte_laptop_record_call(&call);
+	return ret;
 }
 
-/*
- * Custom fan speed. Only works if custom mode is enabled.
- * Must be in multiples of five, between 25 and 100.
- */
-static ssize_t fan_custom_speed_show(struct device *dev, struct device_attribute *attr, char *buf)
+// debugfs record: write 1 to start a new recording, 0 to stop it.
+static ssize_t gigabyte_laptop_record_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	char state[3];
+	int len;
 
-	return sysfs_emit(buf, "%d\n", gigabyte->fan_custom_display_speed);
+	len = scnprintf(state, sizeof(state), "%d\n", READ_ONCE(gigabyte_laptop_recording));
+	return simple_read_from_buffer(buf, count, ppos, state, len);
 }
 
-static ssize_t fan_custom_speed_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+static ssize_t gigabyte_laptop_record_write(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	int ret, output;
-	unsigned int speed;
-	u8 real_speed;
-	struct gigabyte_laptop_wmi *gigabyte;
-
-	ret = kstrtouint(buf, 0, &speed);
-	if (ret)
-		return ret;
-
-	if ((speed < 25 || speed > 100) || speed % 5 != 0) {
-		pr_warn("Invalid custom fan speed: Must be a multiple of 5 and between 25 and 100\n");
-		return -EINVAL;
-	}
+	bool enable;
+	int ret;
 
-	if (speed == 25)
-		real_speed = 0x39;
-	else if (speed == 30)
-		real_speed = 0x44;
-	else if (speed == 35)
-		real_speed = 0x50;
-	else if (speed == 40)
-		real_speed = 0x5B;
-	else if (speed == 45)
-		real_speed = 0x67;
-	else if (speed == 50)
-		real_speed = 0x72;
-	else if (speed == 55)
-		real_speed = 0x7D;
-	else if (speed == 60)
-		real_speed = 0x89;
-	else if (speed == 65)
-		real_speed = 0x94;
-	else if (speed == 70)
-		real_speed = 0xA0;
-	else if (speed == 75)
-		real_speed = 0xAB;
-	else if (speed == 80)
-		real_speed = 0xB7;
-	else if (speed == 85)
-		real_speed = 0xC2;
-	else if (speed == 90)
-		real_speed = 0xCE;
-	else if (speed == 95)
-		real_speed = 0xD9;
-	else if (speed == 100)
-		real_speed = 0xE5;
-
-	ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, real_speed, &output);
+	ret = kstrtobool_from_user(buf, count, &enable);
 	if (ret)
 		return ret;
 
-	gigabyte = dev_get_drvdata(dev);
-	if (gigabyte->dual_fan_speed_enabled) {
-		// We can't modify FAN2 through WMI without modifying GFTY, which
-		// already changes on its own.
-		ret = ec_write(0xB1, real_speed);
+	mutex_lock(&gigabyte_laptop_record_lock);
+	if (enable && !gigabyte_laptop_record) {
+		gigabyte_laptop_record = kvcalloc(RECORD_CALLS, sizeof(*gigabyte_laptop_record),
+						GFP_KERNEL);
+		if (!gigabyte_laptop_record) {
+			mutex_unlock(&gigabyte_laptop_record_lock);
+			return -ENOMEM;
+		}
 	}
-	gigabyte->fan_custom_display_speed = speed;
-	gigabyte->fan_custom_internal_speed = real_speed;
+	if (enable)
+		gigabyte_laptop_record_count = 0;
+	WRITE_ONCE(gigabyte_laptop_recording, enable);
+	mutex_unlock(&gigabyte_laptop_record_lock);
 	return count;
 }
 
-/*
- * Charge mode.
- * 0 = default mode
- * 1 = custom mode
- */
-static ssize_t charge_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+static const struct file_operations gigabyte_laptop_record_fops = {
+	.owner = THIS_MODULE,
+	.read = gigabyte_laptop_record_read,
+	.write = gigabyte_laptop_record_write,
+};
+
+// debugfs calls: the struct aorus_laptop_call records of the last recording.
+static ssize_t gigabyte_laptop_calls_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	ssize_t ret;
 
-	return sysfs_emit(buf, "%d\n", gigabyte->charge_mode);
+	mutex_lock(&gigabyte_laptop_record_lock);
+	ret = simple_read_from_buffer(buf, count, ppos, gigabyte_laptop_record,
+			gigabyte_laptop_record_count * sizeof(*gigabyte_laptop_record));
+	mutex_unlock(&gigabyte_laptop_record_lock);
+	return ret;
 }
 
-static ssize_t charge_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
-{
-	int ret, output;
-	unsigned int mode;
-	struct gigabyte_laptop_wmi *gigabyte;
+static const struct file_operations gigabyte_laptop_calls_fops = {
+	.owner = THIS_MODULE,
+	.read = gigabyte_laptop_calls_read,
+	.llseek = default_llseek,
+};
 
-	ret = kstrtouint(buf, 0, &mode);
-	if (ret)
-		return ret;
+/* WMI methods ********************************************/
 
-	if (mode > 1) {
-		pr_err("Invalid charge mode\n");
-		return -EINVAL;
+/*
+ * Room for an integer or a small buffer result. Evaluating into a caller
+ * provided buffer keeps ACPICA from allocating one on every call.
+ */
+#define WMI_RESULT_BUFFER_SIZE 32
+
+struct gigabyte_laptop_wmi_result {
+	union acpi_object obj;
+	u8 data[WMI_RESULT_BUFFER_SIZE];
+} __aligned(8);
+
+static int gigabyte_laptop_acpi_errno(acpi_status status)
+{
+	switch (status) {
+		case AE_OK:
+			return 0;
+		case AE_NOT_FOUND:
+		case AE_NOT_EXIST:
+			return -ENODEV;
+		case AE_BAD_PARAMETER:
+		case AE_TYPE:
+			return -EINVAL;
+		case AE_NO_MEMORY:
+			return -ENOMEM;
+		case AE_BUFFER_OVERFLOW:
+			return -EOVERFLOW;
+		case AE_TIME:
+			return -ETIMEDOUT;
+		case AE_SUPPORT:
+		case AE_NOT_IMPLEMENTED:
+			return -EOPNOTSUPP;
+		case AE_ACCESS:
+			return -EACCES;
+		default:
+			return -EIO;
 	}
+}
 
-	// Only bit 2 affects the charging mode, so shift 2 bits to the left.
-	ret = gigabyte_laptop_set_devstate(CHARGING_MODE, mode << 2, &output);
-	if (ret)
-		return ret;
+// Features of the bound model. Methods of missing ones are never evaluated.
+static unsigned long gigabyte_laptop_caps = GIGABYTE_LAPTOP_CAPS_ALL;
 
-	gigabyte = dev_get_drvdata(dev);
-	gigabyte->charge_mode = mode;
-	return count;
+static bool gigabyte_laptop_method_supported(u32 method_id)
+{
+	unsigned long cap;
+
+	switch (method_id) {
+		case GPU_QBOOST:
+			cap = GIGABYTE_LAPTOP_CAP_GPU_BOOST;
+			break;
+		case CHARGING_MODE:
+		case CHARGING_LIMIT:
+			cap = GIGABYTE_LAPTOP_CAP_CHARGE;
+			break;
+		default:
+			return true;
+	}
+	return READ_ONCE(gigabyte_laptop_caps) & cap;
 }
 
 /*
- * Maximum charge limit. Only works if custom charge mode is enabled.
- * Can be set between 60 and 100 percent.
+ * Every transaction is traced with its duration and the function that asked
+ * for it. Work done on behalf of an entry point, like a queued write, carries
+ * the _RET_IP_ taken where it was asked for down to here. The accessors
+ * without a caller are always inlined, so that _THIS_IP_ points into the
+ * function using them.
  */
-static ssize_t charge_limit_show(struct device *dev, struct device_attribute *attr, char *buf)
+static int gigabyte_laptop_wmi_call(enum gigabyte_laptop_guid guid, u32 method_id, u32 arg2,
+					struct gigabyte_laptop_wmi_result *res, unsigned long caller)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct acpi_buffer input = { sizeof(arg2), &arg2 };
+	struct acpi_buffer output = { sizeof(*res), res };
+	acpi_status status;
+	u64 start, duration, value = 0;
+	int ret;
 
-	return sysfs_emit(buf, "%d\n", gigabyte->charge_limit);
-}
+	if (!gigabyte_laptop_method_supported(method_id))
+		return -EOPNOTSUPP;
+
+	start = ktime_get_ns();
+	status = gigabyte_laptop_evaluate(guid, method_id, &input, &output);
+	if (ACPI_FAILURE(status))
+		ret = gigabyte_laptop_acpi_errno(status);
+	else if (!output.length) // Nothing was returned by the method.
+		ret = -ENODATA;
+	else
+		ret = 0;
+
+	if (!ret && res->obj.type == ACPI_TYPE_INTEGER)
+		value = res->obj.integer.value;
+	duration = ktime_get_ns() - start;
+	gigabyte_laptop_stats_add(gigabyte_laptop_stats_wmi_slot(guid, method_id), duration, ret);
+	trace_aorus_laptop_wmi(guid, method_id, arg2, status, ret, value, duration, caller);
+	return ret;
+}
+
+static int gigabyte_laptop_wmi_integer(enum gigabyte_laptop_guid guid, u32 method_id, u32 arg2,
+					int *result, unsigned long caller)
+{
+	struct gigabyte_laptop_wmi_result res;
+	int ret;
+
+	ret = gigabyte_laptop_wmi_call(guid, method_id, arg2, &res, caller);
+	if (ret)
+		return ret;
+
+	switch (res.obj.type) {
+		case ACPI_TYPE_INTEGER:
+			*result = res.obj.integer.value;
+			return 0;
+		case ACPI_TYPE_BUFFER:
+			// Use gigabyte_laptop_get_devstate_buffer() for these.
+			return res.obj.buffer.length ? -EMSGSIZE : -ENODATA;
+		default:
+			return -EPROTO;
+	}
+}
+
+/* WMBC method (checks value in EC) */
+static int __gigabyte_laptop_get_devstate2(u32 method_id, u32 arg2, int *result,
+					unsigned long caller)
+{
+	return gigabyte_laptop_wmi_integer(GIGABYTE_LAPTOP_WMBC, method_id, arg2, result, caller);
+}
+
+static __always_inline int gigabyte_laptop_get_devstate2(u32 method_id, u32 arg2, int *result)
+{
+	return __gigabyte_laptop_get_devstate2(method_id, arg2, result, _THIS_IP_);
+}
+
+static __always_inline int gigabyte_laptop_get_devstate(u32 method_id, int *result) {
+	return gigabyte_laptop_get_devstate2(method_id, 0, result);
+}
+
+/*
+ * WMBC methods returning a buffer (e.g. 0x63). Copies at most size bytes and
+ * returns the number of bytes copied.
+ */
+static int __gigabyte_laptop_get_devstate_buffer(u32 method_id, u32 arg2, u8 *buf, size_t size,
+					unsigned long caller)
+{
+	struct gigabyte_laptop_wmi_result res;
+	size_t length;
+	int ret;
+
+	ret = gigabyte_laptop_wmi_call(GIGABYTE_LAPTOP_WMBC, method_id, arg2, &res, caller);
+	if (ret)
+		return ret;
+
+	if (res.obj.type != ACPI_TYPE_BUFFER)
+		return -EPROTO;
+	if (!res.obj.buffer.length)
+		return -ENODATA;
+
+	length = min_t(size_t, res.obj.buffer.length, size);
+	memcpy(buf, res.obj.buffer.pointer, length);
+	return length;
+}
+
+static __always_inline int gigabyte_laptop_get_devstate_buffer(u32 method_id, u32 arg2,
+					u8 *buf, size_t size)
+{
+	return __gigabyte_laptop_get_devstate_buffer(method_id, arg2, buf, size, _THIS_IP_);
+}
+
+/* WMBD method (sets value in EC) */
+static int __gigabyte_laptop_set_devstate(u32 method_id, u32 arg2, int *result,
+					unsigned long caller)
+{
+	return gigabyte_laptop_wmi_integer(GIGABYTE_LAPTOP_WMBD, method_id, arg2, result, caller);
+}
+
+/* EC access *********************************************/
+
+// Every direct EC access of the driver goes through this lock.
+static DEFINE_MUTEX(gigabyte_laptop_ec_lock);
+
+/*
+ * Read several EC registers under one hold of the driver's EC lock, and
+ * account them as one access. Every byte is still its own EC transaction,
+ * since the kernel only exports single-byte EC accessors.
+ * If regs is NULL, count registers starting at start are read.
+ */
+static int gigabyte_laptop_ec_read_block(u8 start, const u8 *regs, u8 *buf, int count,
+					unsigned long caller)
+{
+	int ret = 0;
+	u64 begin, duration;
+
+	mutex_lock(&gigabyte_laptop_ec_lock);
+	begin = ktime_get_ns();
+
+	for (int i = 0; i < count; i++) {
+		ret = gigabyte_laptop_ec_io(AORUS_LAPTOP_CALL_EC_READ, regs ? regs[i] : start + i,
+				&buf[i]);
+		if (ret)
+			break;
+	}
+
+	duration = ktime_get_ns() - begin;
+	gigabyte_laptop_stats_add(STATS_EC_READ, duration, ret);
+	trace_aorus_laptop_ec(false, regs ? regs[0] : start, count, ret ? 0 : buf[0], ret,
+		duration, caller);
+	mutex_unlock(&gigabyte_laptop_ec_lock);
+	return ret;
+}
+
+// The only place the EC is written to. Shares its lock with the reads.
+static int __gigabyte_laptop_ec_write(u8 reg, u8 val, unsigned long caller)
+{
+	int ret;
+	u64 begin, duration;
+
+	mutex_lock(&gigabyte_laptop_ec_lock);
+	begin = ktime_get_ns();
+	ret = gigabyte_laptop_ec_io(AORUS_LAPTOP_CALL_EC_WRITE, reg, &val);
+	duration = ktime_get_ns() - begin;
+	gigabyte_laptop_stats_add(STATS_EC_WRITE, duration, ret);
+	trace_aorus_laptop_ec(true, reg, 1, val, ret, duration, caller);
+	mutex_unlock(&gigabyte_laptop_ec_lock);
+	return ret;
+}
+
+static __always_inline int gigabyte_laptop_ec_write(u8 reg, u8 val)
+{
+	return __gigabyte_laptop_ec_write(reg, val, _THIS_IP_);
+}
+
+static __always_inline int gigabyte_laptop_ec_read_range(u8 start, u8 *buf, int count)
+{
+	return gigabyte_laptop_ec_read_block(start, NULL, buf, count, _THIS_IP_);
+}
+
+/*
+ * The sequences shared with the tests reach the firmware through these. Their
+ * data is the caller to trace, see gigabyte_laptop_fw_caller().
+ */
+static int gigabyte_laptop_fw_wmbc(void *data, u8 method, u32 arg, int *result)
+{
+	return __gigabyte_laptop_get_devstate2(method, arg, result, (unsigned long)data);
+}
+
+static int gigabyte_laptop_fw_wmbd(void *data, u8 method, u32 arg, int *result)
+{
+	return __gigabyte_laptop_set_devstate(method, arg, result, (unsigned long)data);
+}
+
+static int gigabyte_laptop_fw_ec_read(void *data, u8 start, const u8 *regs, u8 *buf, int count)
+{
+	return gigabyte_laptop_ec_read_block(start, regs, buf, count, (unsigned long)data);
+}
+
+static int gigabyte_laptop_fw_ec_write(void *data, u8 reg, u8 val)
+{
+	return __gigabyte_laptop_ec_write(reg, val, (unsigned long)data);
+}
+
+static inline void *gigabyte_laptop_fw_caller(unsigned long caller)
+{
+	return (void *)caller;
+}
+
+static const struct gigabyte_laptop_fw_ops gigabyte_laptop_fw_ops = {
+	.wmbc = gigabyte_laptop_fw_wmbc,
+	.wmbd = gigabyte_laptop_fw_wmbd,
+	.ec_read = gigabyte_laptop_fw_ec_read,
+	.ec_write = gigabyte_laptop_fw_ec_write,
+};
+
+/* Telemetry **********************************************/
+
+/*
+ * Every sensor sample is also appended to a ring of records, which is
+ * streamed through debugfs. Each reader has its own position, and starts
+ * with the oldest record still in the ring. A reader that falls more than
+ * TELEMETRY_RECORDS behind skips ahead, which shows up as a gap in seq.
+ */
+static void gigabyte_laptop_telemetry_push(struct gigabyte_laptop_wmi *gigabyte,
+					const struct gigabyte_laptop_sensors *sample)
+{
+	struct aorus_laptop_record *record;
+	u16 valid = 0;
+
+	spin_lock(&gigabyte->telemetry_lock);
+	record = &gigabyte->telemetry[gigabyte->telemetry_head % TELEMETRY_RECORDS];
+	memset(record, 0, sizeof(*record));
+	record->seq = gigabyte->telemetry_head;
+	record->timestamp = sample->timestamp;
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		record->temp[i] = sample->temp[i];
+		if (!sample->temp_ret[i])
+			valid |= AORUS_LAPTOP_STATUS_TEMP(i);
+	}
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		record->fan[i] = sample->fan[i];
+		if (!sample->fan_ret[i])
+			valid |= AORUS_LAPTOP_STATUS_FAN(i);
+	}
+	record->valid = valid;
+	record->fan_mode = READ_ONCE(gigabyte->fan_mode);
+	record->fan_custom_speed = READ_ONCE(gigabyte->fan_custom_display_speed);
+	gigabyte->telemetry_head++;
+	spin_unlock(&gigabyte->telemetry_lock);
+
+	wake_up_interruptible(&gigabyte->telemetry_wait);
+}
+
+struct gigabyte_laptop_telemetry_reader {
+	struct gigabyte_laptop_wmi *gigabyte;
+	u64 pos;
+};
+
+static int gigabyte_laptop_telemetry_open(struct inode *inode, struct file *file)
+{
+	struct gigabyte_laptop_telemetry_reader *reader;
+	struct gigabyte_laptop_wmi *gigabyte = inode->i_private;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	reader->gigabyte = gigabyte;
+	spin_lock(&gigabyte->telemetry_lock);
+	if (gigabyte->telemetry_head > TELEMETRY_RECORDS)
+		reader->pos = gigabyte->telemetry_head - TELEMETRY_RECORDS;
+	spin_unlock(&gigabyte->telemetry_lock);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int gigabyte_laptop_telemetry_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+// Copy whole records only. Blocks until there is one, unless O_NONBLOCK is set.
+static ssize_t gigabyte_laptop_telemetry_read(struct file *file, char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct gigabyte_laptop_telemetry_reader *reader = file->private_data;
+	struct gigabyte_laptop_wmi *gigabyte = reader->gigabyte;
+	struct aorus_laptop_record *records;
+	size_t n = min_t(size_t, count / sizeof(*records), 64);
+	size_t copied = 0;
+	int ret;
+
+	if (!n)
+		return -EINVAL;
+
+	spin_lock(&gigabyte->telemetry_lock);
+	while (reader->pos == gigabyte->telemetry_head) {
+		spin_unlock(&gigabyte->telemetry_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(gigabyte->telemetry_wait,
+			READ_ONCE(gigabyte->telemetry_head) != reader->pos ||
+			READ_ONCE(gigabyte->telemetry_closed));
+		if (ret)
+			return ret;
+		if (READ_ONCE(gigabyte->telemetry_closed))
+			return 0;
+		spin_lock(&gigabyte->telemetry_lock);
+	}
+	spin_unlock(&gigabyte->telemetry_lock);
+
+	records = kmalloc_array(n, sizeof(*records), GFP_KERNEL);
+	if (!records)
+		return -ENOMEM;
+
+	spin_lock(&gigabyte->telemetry_lock);
+	if (gigabyte->telemetry_head - reader->pos > TELEMETRY_RECORDS)
+		reader->pos = gigabyte->telemetry_head - TELEMETRY_RECORDS;
+	while (copied < n && reader->pos != gigabyte->telemetry_head) {
+		records[copied++] = gigabyte->telemetry[reader->pos % TELEMETRY_RECORDS];
+		reader->pos++;
+	}
+	spin_unlock(&gigabyte->telemetry_lock);
+
+	ret = copy_to_user(buf, records, copied * sizeof(*records)) ? -EFAULT : 0;
+	kfree(records);
+	if (ret)
+		return ret;
+	return copied * sizeof(*records);
+}
+
+static __poll_t gigabyte_laptop_telemetry_poll(struct file *file, poll_table *wait)
+{
+	struct gigabyte_laptop_telemetry_reader *reader = file->private_data;
+	struct gigabyte_laptop_wmi *gigabyte = reader->gigabyte;
+
+	poll_wait(file, &gigabyte->telemetry_wait, wait);
+	if (READ_ONCE(gigabyte->telemetry_closed))
+		return EPOLLHUP;
+	if (READ_ONCE(gigabyte->telemetry_head) != reader->pos)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations gigabyte_laptop_telemetry_fops = {
+	.owner = THIS_MODULE,
+	.open = gigabyte_laptop_telemetry_open,
+	.release = gigabyte_laptop_telemetry_release,
+	.read = gigabyte_laptop_telemetry_read,
+	.poll = gigabyte_laptop_telemetry_poll,
+};
+
+/* Netlink ************************************************/
+
+static const struct genl_multicast_group gigabyte_laptop_genl_mcgrps[] = {
+	{ .name = AORUS_LAPTOP_GENL_MCGRP },
+};
+
+// Only used to multicast, so it has no operations.
+static struct genl_family gigabyte_laptop_genl_family __ro_after_init = {
+	.name = AORUS_LAPTOP_GENL_NAME,
+	.version = AORUS_LAPTOP_GENL_VERSION,
+	.maxattr = AORUS_LAPTOP_ATTR_MAX,
+	.module = THIS_MODULE,
+	.mcgrps = gigabyte_laptop_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(gigabyte_laptop_genl_mcgrps),
+};
+
+static struct sk_buff *gigabyte_laptop_genl_new(u8 cmd, void **hdr)
+{
+	struct sk_buff *skb;
+
+	// Nobody is listening, don't bother building the message.
+	if (!genl_has_listeners(&gigabyte_laptop_genl_family, &init_net, 0))
+		return NULL;
+
+	skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	*hdr = genlmsg_put(skb, 0, 0, &gigabyte_laptop_genl_family, 0, cmd);
+	if (!*hdr) {
+		nlmsg_free(skb);
+		return NULL;
+	}
+	return skb;
+}
+
+static void gigabyte_laptop_genl_send(struct sk_buff *skb, void *hdr)
+{
+	genlmsg_end(skb, hdr);
+	genlmsg_multicast(&gigabyte_laptop_genl_family, skb, 0, 0, GFP_KERNEL);
+}
+
+static int gigabyte_laptop_genl_put_channels(struct sk_buff *skb, int type,
+					const long *val, const int *ret, int channels)
+{
+	struct nlattr *nest;
+
+	nest = nla_nest_start(skb, type);
+	if (!nest)
+		return -EMSGSIZE;
+
+	for (int i = 0; i < channels; i++) {
+		if (ret[i])
+			continue;
+		if (nla_put_u32(skb, i + 1, val[i])) {
+			nla_nest_cancel(skb, nest);
+			return -EMSGSIZE;
+		}
+	}
+
+	nla_nest_end(skb, nest);
+	return 0;
+}
+
+// Channels without a valid reading are left out.
+static void gigabyte_laptop_genl_sample(const struct gigabyte_laptop_sensors *sample)
+{
+	struct sk_buff *skb;
+	void *hdr;
+
+	skb = gigabyte_laptop_genl_new(AORUS_LAPTOP_CMD_SAMPLE, &hdr);
+	if (!skb)
+		return;
+
+	if (nla_put_u64_64bit(skb, AORUS_LAPTOP_ATTR_TIMESTAMP, sample->timestamp,
+				AORUS_LAPTOP_ATTR_PAD) ||
+			gigabyte_laptop_genl_put_channels(skb, AORUS_LAPTOP_ATTR_TEMP,
+				sample->temp, sample->temp_ret, TEMP_CHANNELS) ||
+			gigabyte_laptop_genl_put_channels(skb, AORUS_LAPTOP_ATTR_FAN,
+				sample->fan, sample->fan_ret, FAN_CHANNELS)) {
+		nlmsg_free(skb);
+		return;
+	}
+
+	gigabyte_laptop_genl_send(skb, hdr);
+}
+
+static void gigabyte_laptop_genl_state(const struct gigabyte_laptop_state *state)
+{
+	struct sk_buff *skb;
+	void *hdr;
+
+	skb = gigabyte_laptop_genl_new(AORUS_LAPTOP_CMD_STATE, &hdr);
+	if (!skb)
+		return;
+
+	if (nla_put_u32(skb, AORUS_LAPTOP_ATTR_FAN_MODE, state->fan_mode) ||
+			nla_put_u32(skb, AORUS_LAPTOP_ATTR_FAN_CUSTOM_SPEED, state->fan_custom_speed) ||
+			nla_put_u32(skb, AORUS_LAPTOP_ATTR_CHARGE_MODE, state->charge_mode) ||
+			nla_put_u32(skb, AORUS_LAPTOP_ATTR_CHARGE_LIMIT, state->charge_limit) ||
+			nla_put_u32(skb, AORUS_LAPTOP_ATTR_GPU_BOOST, state->gpu_boost)) {
+		nlmsg_free(skb);
+		return;
+	}
+
+	gigabyte_laptop_genl_send(skb, hdr);
+}
+
+/* hwmon **************************************************/
+
+static const char * const temp_labels[TEMP_CHANNELS] = {
+	"CPU", "GPU", "Motherboard", "GPU 2"
+};
+static const char * const fan_labels[FAN_CHANNELS] = {
+	"CPU", "GPU", "Fan 3", "Fan 4"
+};
+
+static const struct gigabyte_laptop_ec_map default_ec_map = {
+	.temp = { 0, 0, 0x62, 0 },
+};
+
+// ECDV.TCPU, TGP1, FTP1, TGP2, RPM1 and RPM2, see WMBC cases 0xE1 to 0xE5.
+static const struct gigabyte_laptop_ec_map aero_ec_map = {
+	.temp = { 0x60, 0x61, 0x62, 0x64 },
+	.fan = { 0xFC, 0xFE, 0, 0 },
+};
+
+static noinline int gigabyte_laptop_read_temp(struct gigabyte_laptop_wmi *gigabyte, int channel,
+					long *val)
+{
+	return gigabyte_laptop_read_temp_channel(&gigabyte_laptop_fw_ops,
+		gigabyte_laptop_fw_caller(_RET_IP_), &gigabyte->ec_map, channel, val);
+}
+
+static noinline int gigabyte_laptop_read_fan(struct gigabyte_laptop_wmi *gigabyte, int channel,
+					long *val)
+{
+	return gigabyte_laptop_read_fan_channel(&gigabyte_laptop_fw_ops,
+		gigabyte_laptop_fw_caller(_RET_IP_), &gigabyte->ec_map, channel, val);
+}
+
+/*
+ * Check the EC offsets of the model against WMI, and drop every offset that
+ * does not agree so that channel keeps going through WMI. Sensors move between
+ * the two reads, so allow a small difference.
+ */
+static void gigabyte_laptop_verify_ec_map(struct gigabyte_laptop_wmi *gigabyte)
+{
+	struct gigabyte_laptop_ec_map *map = &gigabyte->ec_map;
+	long ec_val, wmi_val;
+	u8 offset;
+
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		if (!map->temp[i] || !temp_methods[i])
+			continue;
+		offset = map->temp[i];
+		map->temp[i] = 0;
+		if (gigabyte_laptop_read_temp(gigabyte, i, &wmi_val))
+			continue;
+		map->temp[i] = offset;
+		if (gigabyte_laptop_read_temp(gigabyte, i, &ec_val) ||
+				abs(ec_val - wmi_val) > 2000) {
+			pr_info("EC offset 0x%02x disagrees with WMI, using WMI for temp%d\n",
+				offset, i + 1);
+			map->temp[i] = 0;
+		}
+	}
+
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		if (!map->fan[i])
+			continue;
+		offset = map->fan[i];
+		map->fan[i] = 0;
+		if (gigabyte_laptop_read_fan(gigabyte, i, &wmi_val))
+			continue;
+		map->fan[i] = offset;
+		if (gigabyte_laptop_read_fan(gigabyte, i, &ec_val) ||
+				abs(ec_val - wmi_val) > max(wmi_val / 10, 200L)) {
+			pr_info("EC offset 0x%02x disagrees with WMI, using WMI for fan%d\n",
+				offset, i + 1);
+			map->fan[i] = 0;
+		}
+	}
+}
+
+/*
+ * Read every candidate channel once and only keep those that answer. The
+ * CPU and GPU channels exist on every model, and so do the ones the model
+ * table lists, whatever they read now. Any other channel must return
+ * something other than 0 or all ones, which is what firmware without it
+ * returns instead of failing. A stopped fan can't be told apart from a
+ * missing one, so known fans belong in the model table.
+ */
+static void gigabyte_laptop_discover_sensors(struct gigabyte_laptop_wmi *gigabyte)
+{
+	u8 temp_known = gigabyte->model->temp_channels | BIT(0) | BIT(1);
+	u8 fan_known = gigabyte->model->fan_channels | BIT(0) | BIT(1);
+	long val;
+
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		if (gigabyte_laptop_read_temp(gigabyte, i, &val))
+			continue;
+		if (!(temp_known & BIT(i)) && (val <= 0 || val >= 255000))
+			continue;
+		gigabyte->temp_present |= BIT(i);
+	}
+
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		if (gigabyte_laptop_read_fan(gigabyte, i, &val))
+			continue;
+		if (!(fan_known & BIT(i)) && (val <= 0 || val >= 0xFFFF))
+			continue;
+		gigabyte->fan_present |= BIT(i);
+	}
+
+	pr_info("Found temp channels 0x%x and fan channels 0x%x\n",
+		gigabyte->temp_present, gigabyte->fan_present);
+}
+
+/*
+ * Sensor sampler. Every channel is read on a fixed cadence and published
+ * into the snapshot, so hwmon readers only ever copy from memory and never
+ * wait on ACPI.
+ */
+static noinline void gigabyte_laptop_sample_sensors(struct gigabyte_laptop_wmi *gigabyte)
+{
+	struct gigabyte_laptop_sensors sample;
+
+	// Channels that fail keep their last good value.
+	read_seqlock_excl(&gigabyte->sensor_seqlock);
+	sample = gigabyte->sensors;
+	read_sequnlock_excl(&gigabyte->sensor_seqlock);
+
+	gigabyte_laptop_read_sensors(&gigabyte_laptop_fw_ops, gigabyte_laptop_fw_caller(_RET_IP_),
+		&gigabyte->ec_map, gigabyte->temp_present, gigabyte->fan_present, &sample);
+
+	sample.timestamp = ktime_get_ns();
+
+	write_seqlock(&gigabyte->sensor_seqlock);
+	gigabyte->sensors = sample;
+	write_sequnlock(&gigabyte->sensor_seqlock);
+
+	gigabyte_laptop_telemetry_push(gigabyte, &sample);
+	gigabyte_laptop_genl_sample(&sample);
+}
+
+static umode_t gigabyte_laptop_hwmon_is_visible(const void *data, enum hwmon_sensor_types type,
+					u32 attr, int channel)
+{
+	const struct gigabyte_laptop_wmi *gigabyte = data;
+
+	switch (type) {
+		case hwmon_chip:
+			switch (attr) {
+				case hwmon_chip_update_interval:
+					return 0644;
+				default:
+					break;
+			}
+			break;
+		case hwmon_temp:
+			if (!(gigabyte->temp_present & BIT(channel)))
+				break;
+			switch (attr) {
+				case hwmon_temp_input:
+				case hwmon_temp_label:
+					return 0444;
+				default:
+					break;
+			}
+			break;
+		case hwmon_fan:
+			if (!(gigabyte->fan_present & BIT(channel)))
+				break;
+			switch (attr) {
+				case hwmon_fan_input:
+				case hwmon_fan_label:
+					return 0444;
+				default:
+					break;
+			}
+			break;
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int gigabyte_laptop_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+					u32 attr, int channel, long *val)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct gigabyte_laptop_sensors *sensors = &gigabyte->sensors;
+	unsigned int seq;
+	int ret;
+
+	if (type == hwmon_chip) {
+		if (attr != hwmon_chip_update_interval)
+			return -EOPNOTSUPP;
+		*val = gigabyte->update_interval;
+		return 0;
+	}
+
+	do {
+		seq = read_seqbegin(&gigabyte->sensor_seqlock);
+		switch (type) {
+			case hwmon_temp:
+				ret = sensors->temp_ret[channel];
+				*val = sensors->temp[channel];
+				break;
+			case hwmon_fan:
+				ret = sensors->fan_ret[channel];
+				*val = sensors->fan[channel];
+				break;
+			default:
+				ret = -EOPNOTSUPP;
+				break;
+		}
+	} while (read_seqretry(&gigabyte->sensor_seqlock, seq));
+	return ret;
+}
+
+static int gigabyte_laptop_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+					u32 attr, int channel, long val)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	if (type != hwmon_chip || attr != hwmon_chip_update_interval)
+		return -EOPNOTSUPP;
+
+	// Anything shorter than the time a full refresh takes is pointless.
+	WRITE_ONCE(gigabyte->update_interval, clamp_val(val, 100, 60000));
+	mod_delayed_work(system_wq, &gigabyte->sensor_work, 0);
+	return 0;
+}
+
+static int gigabyte_laptop_hwmon_read_string(struct device *dev, enum hwmon_sensor_types type,
+					u32 attr, int channel, const char **str)
+{
+	switch (type) {
+		case hwmon_temp:
+			*str = temp_labels[channel];
+			return 0;
+		case hwmon_fan:
+			*str = fan_labels[channel];
+			return 0;
+		default:
+			return -EOPNOTSUPP;
+	}
+}
+
+static const struct hwmon_channel_info * const gigabyte_laptop_hwmon_chip =
+	HWMON_CHANNEL_INFO(chip,
+				HWMON_C_UPDATE_INTERVAL);
+
+static const struct hwmon_ops gigabyte_laptop_hwmon_ops = {
+	.read = gigabyte_laptop_hwmon_read,
+	.read_string = gigabyte_laptop_hwmon_read_string,
+	.write = gigabyte_laptop_hwmon_write,
+	.is_visible = gigabyte_laptop_hwmon_is_visible,
+};
+
+/*
+ * Build the channel table from the channels found at probe time. It ends
+ * at the last channel present, and is_visible hides any gap before that, so
+ * channels keep their numbers on every model.
+ */
+static void gigabyte_laptop_hwmon_init(struct gigabyte_laptop_wmi *gigabyte)
+{
+	for (int i = 0; i < fls(gigabyte->temp_present); i++)
+		gigabyte->temp_config[i] = HWMON_T_INPUT | HWMON_T_LABEL;
+	for (int i = 0; i < fls(gigabyte->fan_present); i++)
+		gigabyte->fan_config[i] = HWMON_F_INPUT | HWMON_F_LABEL;
+
+	gigabyte->temp_info.type = hwmon_temp;
+	gigabyte->temp_info.config = gigabyte->temp_config;
+	gigabyte->fan_info.type = hwmon_fan;
+	gigabyte->fan_info.config = gigabyte->fan_config;
+
+	gigabyte->hwmon_info[0] = gigabyte_laptop_hwmon_chip;
+	gigabyte->hwmon_info[1] = &gigabyte->temp_info;
+	gigabyte->hwmon_info[2] = &gigabyte->fan_info;
+	gigabyte->hwmon_info[3] = NULL;
+
+	gigabyte->chip_info.ops = &gigabyte_laptop_hwmon_ops;
+	gigabyte->chip_info.info = gigabyte->hwmon_info;
+}
+
+/* Status page ********************************************/
+
+/*
+ * Copy the latest sample and the cached state into the page userspace can
+ * map, so it can be polled without any syscall. Updated after every sample
+ * and every applied write. Netlink subscribers are told when the state
+ * has changed.
+ */
+static void gigabyte_laptop_publish_status(struct gigabyte_laptop_wmi *gigabyte)
+{
+	struct aorus_laptop_status *status = gigabyte->status;
+	struct gigabyte_laptop_sensors sensors;
+	struct gigabyte_laptop_state state;
+	bool changed;
+	unsigned int seq;
+	u32 valid = 0;
+
+	static_assert(ARRAY_SIZE(status->temp) == TEMP_CHANNELS);
+	static_assert(ARRAY_SIZE(status->fan) == FAN_CHANNELS);
+
+	do {
+		seq = read_seqbegin(&gigabyte->sensor_seqlock);
+		sensors = gigabyte->sensors;
+	} while (read_seqretry(&gigabyte->sensor_seqlock, seq));
+
+	spin_lock(&gigabyte->status_lock);
+	WRITE_ONCE(status->seq, status->seq + 1);
+	smp_wmb();
+
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		status->temp[i] = sensors.temp[i];
+		if (!sensors.temp_ret[i])
+			valid |= AORUS_LAPTOP_STATUS_TEMP(i);
+	}
+	for (int i = 0; i < FAN_CHANNELS; i++) {
+		status->fan[i] = sensors.fan[i];
+		if (!sensors.fan_ret[i])
+			valid |= AORUS_LAPTOP_STATUS_FAN(i);
+	}
+	status->valid = valid;
+	status->timestamp = sensors.timestamp;
+	state.fan_mode = READ_ONCE(gigabyte->fan_mode);
+	state.fan_custom_speed = READ_ONCE(gigabyte->fan_custom_display_speed);
+	state.charge_mode = READ_ONCE(gigabyte->charge_mode);
+	state.charge_limit = READ_ONCE(gigabyte->charge_limit);
+	state.gpu_boost = READ_ONCE(gigabyte->gpu_boost);
+	status->fan_mode = state.fan_mode;
+	status->fan_custom_speed = state.fan_custom_speed;
+	status->charge_mode = state.charge_mode;
+	status->charge_limit = state.charge_limit;
+	status->gpu_boost = state.gpu_boost;
+	status->fan_control = READ_ONCE(gigabyte->fan_control_enabled);
+
+	smp_wmb();
+	WRITE_ONCE(status->seq, status->seq + 1);
+
+	changed = memcmp(&state, &gigabyte->netlink_state, sizeof(state));
+	gigabyte->netlink_state = state;
+	spin_unlock(&gigabyte->status_lock);
+
+	if (changed)
+		gigabyte_laptop_genl_state(&state);
+}
+
+/* Command queue ******************************************/
+
+/*
+ * sysfs writes only validate their input and queue it. A later write to the
+ * same control replaces a pending one, so a burst of writes ends up as a
+ * single EC sequence. Errors are reported through the sync node, or directly
+ * when blocking_writes is set.
+ */
+static int gigabyte_laptop_kick_commands(struct gigabyte_laptop_wmi *gigabyte)
+{
+	schedule_work(&gigabyte->cmd_work);
+
+	if (!READ_ONCE(blocking_writes))
+		return 0;
+
+	flush_work(&gigabyte->cmd_work);
+	return xchg(&gigabyte->cmd_error, 0);
+}
+
+static void __gigabyte_laptop_post_command(struct gigabyte_laptop_wmi *gigabyte,
+					enum gigabyte_laptop_command cmd, int value, unsigned long caller)
+{
+	spin_lock(&gigabyte->cmd_lock);
+	gigabyte->cmd_value[cmd] = value;
+	gigabyte->cmd_caller[cmd] = caller;
+	__set_bit(cmd, &gigabyte->cmd_pending);
+	spin_unlock(&gigabyte->cmd_lock);
+
+	schedule_work(&gigabyte->cmd_work);
+}
+
+/*
+ * Queue a command from inside the driver. Never waits, even with
+ * blocking_writes. Like the other queueing functions, it isn't inlined so
+ * that _RET_IP_ is the function that queued the command.
+ */
+static noinline void gigabyte_laptop_post_command(struct gigabyte_laptop_wmi *gigabyte,
+					enum gigabyte_laptop_command cmd, int value)
+{
+	__gigabyte_laptop_post_command(gigabyte, cmd, value, _RET_IP_);
+}
+
+static noinline int gigabyte_laptop_queue_command(struct gigabyte_laptop_wmi *gigabyte,
+					enum gigabyte_laptop_command cmd, int value)
+{
+	__gigabyte_laptop_post_command(gigabyte, cmd, value, _RET_IP_);
+	return gigabyte_laptop_kick_commands(gigabyte);
+}
+
+/*
+ * Whether a thermal cooling device drives the fans, or has yet to hand them
+ * back to the EC. Called under state_lock.
+ */
+static bool gigabyte_laptop_cooling_engaged(struct gigabyte_laptop_wmi *gigabyte)
+{
+	for (int i = 0; i < COOLING_FANS; i++)
+		if (gigabyte->cooling[i].state)
+			return true;
+	return gigabyte->cooling_active;
+}
+
+/*
+ * Queue a fan mode or speed, unless the in-driver fan control or a cooling
+ * device owns the fans. The check is made under state_lock, so it can't race
+ * with either of them taking over.
+ */
+static noinline int gigabyte_laptop_queue_fan_command(struct gigabyte_laptop_wmi *gigabyte,
+					enum gigabyte_laptop_command cmd, int value)
+{
+	mutex_lock(&gigabyte->state_lock);
+	if (gigabyte->fan_control_enabled || gigabyte_laptop_cooling_engaged(gigabyte)) {
+		mutex_unlock(&gigabyte->state_lock);
+		return -EBUSY;
+	}
+	__gigabyte_laptop_post_command(gigabyte, cmd, value, _RET_IP_);
+	mutex_unlock(&gigabyte->state_lock);
+
+	return gigabyte_laptop_kick_commands(gigabyte);
+}
+
+static void gigabyte_laptop_read_fan_curve(struct gigabyte_laptop_wmi *gigabyte,
+					struct fan_curve_data *curve)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&gigabyte->state_seq);
+		*curve = gigabyte->fan_curve;
+	} while (read_seqcount_retry(&gigabyte->state_seq, seq));
+}
+
+/*
+ * Queue a new fan curve. With a negative index the whole curve is replaced,
+ * otherwise only that point is taken from it.
+ */
+static noinline int gigabyte_laptop_queue_fan_curve(struct gigabyte_laptop_wmi *gigabyte,
+					const struct fan_curve_data *curve, int index)
+{
+	struct fan_curve_data current_curve;
+
+	// The rest of the curve comes from the one probe_work reads.
+	if (index >= 0) {
+		flush_work(&gigabyte->probe_work);
+		gigabyte_laptop_read_fan_curve(gigabyte, &current_curve);
+	}
+
+	spin_lock(&gigabyte->cmd_lock);
+	if (index < 0) {
+		gigabyte->cmd_curve = *curve;
+	} else {
+		if (!test_bit(CMD_FAN_CURVE, &gigabyte->cmd_pending))
+			gigabyte->cmd_curve = current_curve;
+		gigabyte->cmd_curve.temperature[index] = curve->temperature[index];
+		gigabyte->cmd_curve.speed[index] = curve->speed[index];
+	}
+	gigabyte->cmd_caller[CMD_FAN_CURVE] = _RET_IP_;
+	__set_bit(CMD_FAN_CURVE, &gigabyte->cmd_pending);
+	spin_unlock(&gigabyte->cmd_lock);
+
+	return gigabyte_laptop_kick_commands(gigabyte);
+}
+
+/* Fan controller *****************************************/
+
+/*
+ * Optional closed-loop fan control. On every sensor sample, the hottest of
+ * the CPU and GPU is run through a curve with hysteresis and a ramp limit,
+ * and the result is sent as a raw EC duty, so the speed is not limited to
+ * the steps of fan_custom_speed. The EC is only written when the duty
+ * actually changes. Speeds are handled in tenths of a percent.
+ */
+static const struct fan_control_data default_fan_control = {
+	.points = 6,
+	.temperature = { 40, 50, 60, 70, 80, 90 },
+	.speed = { 25, 35, 50, 65, 85, 100 },
+};
+
+static u8 fan_control_duty(int speed)
+{
+	return speed * FAN_DUTY_MAX / 1000;
+}
+
+static int fan_control_interpolate(const struct fan_control_data *curve, long temp)
+{
+	long t0, t1;
+	int s0, s1;
+
+	if (temp <= curve->temperature[0] * 1000L)
+		return curve->speed[0] * 10;
+
+	for (int i = 1; i < curve->points; i++) {
+		t1 = curve->temperature[i] * 1000L;
+		if (temp > t1)
+			continue;
+		t0 = curve->temperature[i - 1] * 1000L;
+		s0 = curve->speed[i - 1] * 10;
+		s1 = curve->speed[i] * 10;
+		if (t1 == t0)
+			return s1;
+		return s0 + (s1 - s0) * (temp - t0) / (t1 - t0);
+	}
+
+	return curve->speed[curve->points - 1] * 10;
+}
+
+static void gigabyte_laptop_fan_control_step(struct gigabyte_laptop_wmi *gigabyte)
+{
+	struct gigabyte_laptop_sensors *sensors = &gigabyte->sensors;
+	struct fan_control_data curve;
+	int hysteresis, ramp, target, speed;
+	long temp = LONG_MIN;
+	unsigned int seq;
+	u8 duty;
+
+	if (!READ_ONCE(gigabyte->fan_control_enabled))
+		return;
+
+	spin_lock(&gigabyte->fan_control_lock);
+	curve = gigabyte->fan_control;
+	hysteresis = gigabyte->fan_control_hysteresis * 1000;
+	ramp = gigabyte->fan_control_ramp * 10;
+	spin_unlock(&gigabyte->fan_control_lock);
+
+	do {
+		seq = read_seqbegin(&gigabyte->sensor_seqlock);
+		for (int i = 0; i < TEMP_CHANNELS; i++)
+			if (i != TEMP_MOTHERBOARD && !sensors->temp_ret[i])
+				temp = max(temp, sensors->temp[i]);
+	} while (read_seqretry(&gigabyte->sensor_seqlock, seq));
+
+	// The controller state is reset under state_lock when fan control is turned on.
+	mutex_lock(&gigabyte->state_lock);
+	if (!gigabyte->fan_control_enabled) {
+		mutex_unlock(&gigabyte->state_lock);
+		return;
+	}
+
+	// Without a temperature, go to full speed at once to be safe.
+	if (temp == LONG_MIN) {
+		speed = 1000;
+	} else {
+		// Follow rising temperatures at once, falling ones past the hysteresis.
+		if (temp > gigabyte->fan_control_temp ||
+				temp < gigabyte->fan_control_temp - hysteresis)
+			gigabyte->fan_control_temp = temp;
+		target = fan_control_interpolate(&curve, gigabyte->fan_control_temp);
+		speed = clamp(target, gigabyte->fan_control_speed - ramp,
+				gigabyte->fan_control_speed + ramp);
+		// The starting speed can be below the minimum, so clamp after the ramp.
+		speed = clamp(speed, FAN_SPEED_MIN * 10, 1000);
+	}
+	gigabyte->fan_control_speed = speed;
+
+	duty = fan_control_duty(speed);
+	if (duty != gigabyte->fan_control_duty) {
+		gigabyte->fan_control_duty = duty;
+		gigabyte_laptop_post_command(gigabyte, CMD_FAN_DUTY, duty);
+	}
+	mutex_unlock(&gigabyte->state_lock);
+}
+
+static void gigabyte_laptop_sensor_work(struct work_struct *work)
+{
+	struct gigabyte_laptop_wmi *gigabyte = container_of(to_delayed_work(work),
+			struct gigabyte_laptop_wmi, sensor_work);
+
+	gigabyte_laptop_sample_sensors(gigabyte);
+	gigabyte_laptop_fan_control_step(gigabyte);
+	gigabyte_laptop_publish_status(gigabyte);
+	schedule_delayed_work(&gigabyte->sensor_work,
+			msecs_to_jiffies(READ_ONCE(gigabyte->update_interval)));
+}
+
+/* sysfs **************************************************/
+
+/*
+ * Fan mode.
+ * 0 = normal fan mode
+ * 1 = silent fan mode
+ * 2 = gaming fan mode
+ * 3 = custom fan mode
+ * 4 = auto-maximum mode (requires custom mode)
+ * 5 = fixed speed mode (requires custom mode)
+ */
+static int set_fan_mode(struct gigabyte_laptop_wmi *gigabyte, int fan_mode, unsigned long caller)
+{
+	return gigabyte_laptop_switch_fan_mode(&gigabyte_laptop_fw_ops,
+			gigabyte_laptop_fw_caller(caller), gigabyte->fan_mode, fan_mode,
+			gigabyte->fan_custom_internal_speed);
+}
+
+static ssize_t fan_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->fan_mode));
+}
+
+static int gigabyte_laptop_apply_fan_mode(struct gigabyte_laptop_wmi *gigabyte, int fan_mode,
+					unsigned long caller)
+{
+	int ret;
+
+	if (gigabyte->fan_mode == fan_mode)
+		return 0;
+
+	ret = set_fan_mode(gigabyte, fan_mode, caller);
+	if (ret) {
+		// The switch may have stopped halfway, so find out where it ended up.
+		__gigabyte_laptop_post_command(gigabyte, CMD_REFRESH, 0, caller);
+		return ret;
+	}
+
+	WRITE_ONCE(gigabyte->fan_mode, fan_mode);
+	return 0;
+}
+
+static ssize_t fan_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned int fan_mode = 0;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &fan_mode);
+	if (ret) {
+		pr_err("kstrtouint failed\n");
+		return count;
+	}
+
+	if (fan_mode > 5) {
+		pr_err("Invalid fan mode\n");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_fan_command(gigabyte, CMD_FAN_MODE, fan_mode);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * Custom fan speed. Only works if custom mode is enabled.
+ * Must be in multiples of five, between 25 and 100.
+ */
+static ssize_t fan_custom_speed_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->fan_custom_display_speed));
+}
+
+static int gigabyte_laptop_apply_fan_speed(struct gigabyte_laptop_wmi *gigabyte, int speed,
+					unsigned long caller)
+{
+	int ret, output;
+	u8 real_speed;
+
+	real_speed = fan_speed_to_duty(speed);
+
+	ret = __gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, real_speed, &output, caller);
+	if (ret)
+		return ret;
+
+	if (gigabyte->dual_fan_speed_enabled) {
+		// We can't modify FAN2 through WMI without modifying GFTY, which
+		// already changes on its own.
+		ret = __gigabyte_laptop_ec_write(EC_FAN2_SPEED, real_speed, caller);
+	}
+	WRITE_ONCE(gigabyte->fan_custom_display_speed, speed);
+	gigabyte->fan_custom_internal_speed = real_speed;
+	return 0;
+}
+
+static int gigabyte_laptop_apply_fan_duty(struct gigabyte_laptop_wmi *gigabyte, int duty,
+					unsigned long caller)
+{
+	int ret, output;
+
+	// A duty taken off the queue just before fan control was turned off.
+	if (!gigabyte->fan_control_enabled)
+		return 0;
+
+	ret = __gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, duty, &output, caller);
+	if (ret)
+		return ret;
+
+	if (gigabyte->dual_fan_speed_enabled)
+		ret = __gigabyte_laptop_ec_write(EC_FAN2_SPEED, duty, caller);
+	WRITE_ONCE(gigabyte->fan_custom_display_speed, DIV_ROUND_CLOSEST(duty * 100, FAN_DUTY_MAX));
+	gigabyte->fan_custom_internal_speed = duty;
+	return 0;
+}
+
+/*
+ * Apply the cooling device states. The first fan to leave state 0 switches
+ * to fixed mode, and the last one back hands the fans to the EC again, in
+ * the mode and custom speed they had before. While one fan is driven, a fan
+ * in state 0 is left at the custom speed the firmware has for it.
+ */
+static int gigabyte_laptop_apply_cooling(struct gigabyte_laptop_wmi *gigabyte, int unused,
+					unsigned long caller)
+{
+	struct gigabyte_laptop_cooling *cooling;
+	bool driven = false;
+	int ret, output;
+	u8 duty, custom;
+
+	for (int i = 0; i < COOLING_FANS; i++)
+		driven |= gigabyte->cooling[i].state;
+
+	// The custom speed is 0 until one is set, which would stop the fans.
+	custom = max_t(int, gigabyte->fan_custom_internal_speed, fan_speed_to_duty(FAN_SPEED_MIN));
+
+	if (!driven) {
+		if (!gigabyte->cooling_active)
+			return 0;
+
+		ret = __gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, custom, &output, caller);
+		if (!ret && gigabyte->dual_fan_speed_enabled)
+			ret = __gigabyte_laptop_ec_write(EC_FAN2_SPEED, custom, caller);
+		if (!ret)
+			ret = gigabyte_laptop_apply_fan_mode(gigabyte, gigabyte->cooling_saved_mode,
+					caller);
+		if (ret)
+			return ret;
+
+		for (int i = 0; i < COOLING_FANS; i++)
+			gigabyte->cooling[i].duty = 0;
+		gigabyte->cooling_active = false;
+		return 0;
+	}
+
+	if (!gigabyte->cooling_active) {
+		gigabyte->cooling_saved_mode = gigabyte->fan_mode;
+		ret = gigabyte_laptop_apply_fan_mode(gigabyte, 5, caller);
+		if (ret)
+			return ret;
+		gigabyte->cooling_active = true;
+	}
+
+	for (int i = 0; i < COOLING_FANS; i++) {
+		cooling = &gigabyte->cooling[i];
+		if (!cooling->cdev)
+			continue;
+
+		duty = cooling->state ? fan_speed_duty[cooling->state - 1] : custom;
+		if (duty == cooling->duty)
+			continue;
+
+		// FAN2 can only be set on its own through the EC.
+		if (i)
+			ret = __gigabyte_laptop_ec_write(EC_FAN2_SPEED, duty, caller);
+		else
+			ret = __gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, duty, &output, caller);
+		if (ret)
+			return ret;
+		cooling->duty = duty;
+	}
+	return 0;
+}
+
+static ssize_t fan_custom_speed_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned int speed;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &speed);
+	if (ret)
+		return ret;
+
+	if (!fan_speed_valid(speed)) {
+		pr_warn("Invalid custom fan speed: Must be a multiple of 5 and between 25 and 100\n");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_fan_command(gigabyte, CMD_FAN_SPEED, speed);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * Charge mode.
+ * 0 = default mode
+ * 1 = custom mode
+ */
+static ssize_t charge_mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->charge_mode));
+}
+
+static int gigabyte_laptop_apply_charge_mode(struct gigabyte_laptop_wmi *gigabyte, int mode,
+					unsigned long caller)
+{
+	int ret, output;
+
+	// Only bit 2 affects the charging mode, so shift 2 bits to the left.
+	ret = __gigabyte_laptop_set_devstate(CHARGING_MODE, mode << 2, &output, caller);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(gigabyte->charge_mode, mode);
+	return 0;
+}
+
+static ssize_t charge_mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned int mode;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &mode);
+	if (ret)
+		return ret;
+
+	if (mode > 1) {
+		pr_err("Invalid charge mode\n");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_command(gigabyte, CMD_CHARGE_MODE, mode);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * Maximum charge limit. Only works if custom charge mode is enabled.
+ * Can be set between 60 and 100 percent.
+ */
+static ssize_t charge_limit_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->charge_limit));
+}
+
+static int gigabyte_laptop_apply_charge_limit(struct gigabyte_laptop_wmi *gigabyte, int limit,
+					unsigned long caller)
+{
+	int ret, output;
+
+	ret = __gigabyte_laptop_set_devstate(CHARGING_LIMIT, limit, &output, caller);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(gigabyte->charge_limit, limit);
+	return 0;
+}
 
 static ssize_t charge_limit_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-	int ret, output;
-	unsigned int limit;
-	struct gigabyte_laptop_wmi *gigabyte;
+	int ret;
+	unsigned int limit;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &limit);
+	if (ret)
+		return ret;
+
+	if (limit > 100 || limit < 60) {
+		pr_err("Invalid charge limit\n");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_command(gigabyte, CMD_CHARGE_LIMIT, limit);
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t gpu_boost_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->gpu_boost));
+}
+
+static int gigabyte_laptop_apply_gpu_boost(struct gigabyte_laptop_wmi *gigabyte, int mode,
+					unsigned long caller)
+{
+	int ret, output;
+
+	ret = __gigabyte_laptop_set_devstate(GPU_QBOOST, mode, &output, caller);
+	if (ret)
+		return ret;
+
+	WRITE_ONCE(gigabyte->gpu_boost, mode);
+	return 0;
+}
+
+static ssize_t gpu_boost_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned int mode;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &mode);
+	if (ret)
+		return ret;
+
+	// TODO: Check for AORUS laptops with 4 modes
+	if (mode > 3) {
+		pr_err("Invalid boost mode");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_command(gigabyte, CMD_GPU_BOOST, mode);
+	if (ret)
+		return ret;
+	return count;
+}
+
+static ssize_t fan_curve_index_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->fan_curve_index));
+}
+
+static ssize_t fan_curve_index_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned int index;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtouint(buf, 0, &index);
+	if (ret)
+		return ret;
+
+	if (index >= FAN_CURVE_POINTS) {
+		pr_err("Invalid fan curve index\n");
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	WRITE_ONCE(gigabyte->fan_curve_index, index);
+	return count;
+}
+
+static ssize_t fan_curve_data_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	int index = READ_ONCE(gigabyte->fan_curve_index);
+	struct fan_curve_data curve;
+
+	flush_work(&gigabyte->probe_work);
+	gigabyte_laptop_read_fan_curve(gigabyte, &curve);
+
+	return sysfs_emit(buf, "%d %d\n", curve.temperature[index], curve.speed[index]);
+}
+
+/*
+ * Send the points of a new fan curve that differ from the current one. The
+ * EC is only told about points that actually changed.
+ */
+static int gigabyte_laptop_apply_fan_curve(struct gigabyte_laptop_wmi *gigabyte,
+					const struct fan_curve_data *curve, unsigned long caller)
+{
+	struct fan_curve_data *current_curve = &gigabyte->fan_curve;
+	int ret, output;
+
+	for (u8 i = 0; i < FAN_CURVE_POINTS; i++) {
+		if (curve->temperature[i] == current_curve->temperature[i] &&
+				curve->speed[i] == current_curve->speed[i])
+			continue;
+
+		ret = __gigabyte_laptop_set_devstate(FAN_INDEX_VALUE,
+			fan_curve_payload(i, curve->temperature[i], curve->speed[i]), &output, caller);
+		if (ret)
+			return ret;
+
+		write_seqcount_begin(&gigabyte->state_seq);
+		current_curve->temperature[i] = curve->temperature[i];
+		current_curve->speed[i] = curve->speed[i];
+		write_seqcount_end(&gigabyte->state_seq);
+	}
+	return 0;
+}
+
+static ssize_t fan_curve_data_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	int ret, index;
+	u16 data;
+	struct fan_curve_data curve;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtou16(buf, 0, &data);
+	if (ret)
+		return ret;
+
+	gigabyte = dev_get_drvdata(dev);
+	index = READ_ONCE(gigabyte->fan_curve_index);
+	fan_curve_point_unpack(data, &curve.temperature[index], &curve.speed[index]);
+
+	ret = gigabyte_laptop_queue_fan_curve(gigabyte, &curve, index);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * The whole fan curve, as one "temperature speed" pair per point. Writes take
+ * all points at once, separated by any whitespace.
+ */
+static ssize_t fan_curve_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct fan_curve_data curve;
+	int len = 0;
+
+	flush_work(&gigabyte->probe_work);
+	gigabyte_laptop_read_fan_curve(gigabyte, &curve);
+
+	for (int i = 0; i < FAN_CURVE_POINTS; i++)
+		len += sysfs_emit_at(buf, len, "%d %d\n", curve.temperature[i], curve.speed[i]);
+	return len;
+}
+
+static ssize_t fan_curve_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int temperature, speed;
+	struct fan_curve_data curve;
+	struct gigabyte_laptop_wmi *gigabyte;
+	int ret, n;
+
+	for (int i = 0; i < FAN_CURVE_POINTS; i++) {
+		if (sscanf(buf, "%u %u%n", &temperature, &speed, &n) != 2) {
+			pr_err("Fan curve needs %d temperature and speed pairs\n", FAN_CURVE_POINTS);
+			return -EINVAL;
+		}
+		buf += n;
+
+		if (temperature > 100 || speed > 255) {
+			pr_err("Invalid fan curve point %d\n", i);
+			return -EINVAL;
+		}
+		if (i && (temperature < curve.temperature[i - 1] || speed < curve.speed[i - 1])) {
+			pr_err("Fan curve must be non-decreasing\n");
+			return -EINVAL;
+		}
+		curve.temperature[i] = temperature;
+		curve.speed[i] = speed;
+	}
+
+	if (*skip_spaces(buf)) {
+		pr_err("Fan curve needs %d temperature and speed pairs\n", FAN_CURVE_POINTS);
+		return -EINVAL;
+	}
+
+	gigabyte = dev_get_drvdata(dev);
+	ret = gigabyte_laptop_queue_fan_curve(gigabyte, &curve, -1);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * Re-read the state that firmware hotkeys can change behind the driver's
+ * back, and wake up pollers of every node whose value changed.
+ */
+static int gigabyte_laptop_refresh_state(struct gigabyte_laptop_wmi *gigabyte, int unused,
+					unsigned long caller)
+{
+	struct kobject *kobj = &gigabyte->pdev->dev.kobj;
+	int ret, output, mode;
+
+	ret = gigabyte_laptop_read_fan_mode(&gigabyte_laptop_fw_ops,
+			gigabyte_laptop_fw_caller(caller), gigabyte->fan_silent_method, &mode);
+	if (!ret && mode != gigabyte->fan_mode) {
+		WRITE_ONCE(gigabyte->fan_mode, mode);
+		sysfs_notify(kobj, NULL, "fan_mode");
+	}
+
+	ret = __gigabyte_laptop_get_devstate2(CHARGING_MODE, 0, &output, caller);
+	if (!ret && output >> 2 != gigabyte->charge_mode) {
+		WRITE_ONCE(gigabyte->charge_mode, output >> 2);
+		sysfs_notify(kobj, NULL, "charge_mode");
+	}
+
+	ret = __gigabyte_laptop_get_devstate2(CHARGING_LIMIT, 0, &output, caller);
+	if (!ret && output && output != gigabyte->charge_limit) {
+		WRITE_ONCE(gigabyte->charge_limit, output);
+		sysfs_notify(kobj, NULL, "charge_limit");
+	}
+
+	ret = __gigabyte_laptop_get_devstate2(GPU_QBOOST, 0, &output, caller);
+	if (!ret && output != gigabyte->gpu_boost) {
+		WRITE_ONCE(gigabyte->gpu_boost, output);
+		sysfs_notify(kobj, NULL, "gpu_boost");
+	}
+
+	return 0;
+}
+
+static int (* const gigabyte_laptop_commands[CMD_COUNT])(struct gigabyte_laptop_wmi *, int,
+					unsigned long) = {
+	[CMD_REFRESH] = gigabyte_laptop_refresh_state,
+	[CMD_FAN_SPEED] = gigabyte_laptop_apply_fan_speed,
+	[CMD_FAN_DUTY] = gigabyte_laptop_apply_fan_duty,
+	[CMD_COOLING] = gigabyte_laptop_apply_cooling,
+	[CMD_FAN_MODE] = gigabyte_laptop_apply_fan_mode,
+	[CMD_CHARGE_MODE] = gigabyte_laptop_apply_charge_mode,
+	[CMD_CHARGE_LIMIT] = gigabyte_laptop_apply_charge_limit,
+	[CMD_GPU_BOOST] = gigabyte_laptop_apply_gpu_boost,
+};
+
+// Nodes whose pollers are woken up once a command has been applied.
+static const char * const gigabyte_laptop_command_nodes[CMD_COUNT] = {
+	[CMD_FAN_SPEED] = "fan_custom_speed",
+	[CMD_FAN_DUTY] = "fan_custom_speed",
+	[CMD_COOLING] = "fan_mode",
+	[CMD_FAN_CURVE] = "fan_curve",
+	[CMD_FAN_MODE] = "fan_mode",
+	[CMD_CHARGE_MODE] = "charge_mode",
+	[CMD_CHARGE_LIMIT] = "charge_limit",
+	[CMD_GPU_BOOST] = "gpu_boost",
+};
+
+/*
+ * Tell platform_profile that the fan mode or GPU boost changed. It can't be
+ * called under state_lock, which profile_set takes inside the core's lock.
+ */
+static void gigabyte_laptop_profile_notify(struct gigabyte_laptop_wmi *gigabyte)
+{
+	mutex_lock(&gigabyte->profile_lock);
+	if (gigabyte->ppdev)
+		platform_profile_notify(gigabyte->ppdev);
+	mutex_unlock(&gigabyte->profile_lock);
+}
+
+static void gigabyte_laptop_cmd_work(struct work_struct *work)
+{
+	struct gigabyte_laptop_wmi *gigabyte = container_of(work,
+			struct gigabyte_laptop_wmi, cmd_work);
+	int value[CMD_COUNT];
+	unsigned long caller[CMD_COUNT];
+	struct fan_curve_data curve;
+	unsigned long pending;
+	unsigned int cmd;
+	int ret, fan_mode, gpu_boost;
+
+	// The fan curve and dual fan control are only known after this.
+	flush_work(&gigabyte->probe_work);
+
+	for (;;) {
+		spin_lock(&gigabyte->cmd_lock);
+		pending = gigabyte->cmd_pending;
+		gigabyte->cmd_pending = 0;
+		memcpy(value, gigabyte->cmd_value, sizeof(value));
+		memcpy(caller, gigabyte->cmd_caller, sizeof(caller));
+		curve = gigabyte->cmd_curve;
+		spin_unlock(&gigabyte->cmd_lock);
+
+		if (!pending)
+			break;
+
+		fan_mode = READ_ONCE(gigabyte->fan_mode);
+		gpu_boost = READ_ONCE(gigabyte->gpu_boost);
+		for_each_set_bit(cmd, &pending, CMD_COUNT) {
+			mutex_lock(&gigabyte->state_lock);
+			if (cmd == CMD_FAN_CURVE)
+				ret = gigabyte_laptop_apply_fan_curve(gigabyte, &curve, caller[cmd]);
+			else
+				ret = gigabyte_laptop_commands[cmd](gigabyte, value[cmd], caller[cmd]);
+			mutex_unlock(&gigabyte->state_lock);
+			if (ret) {
+				pr_err("Command %u failed with %d\n", cmd, ret);
+				cmpxchg(&gigabyte->cmd_error, 0, ret);
+			} else if (gigabyte_laptop_command_nodes[cmd]) {
+				sysfs_notify(&gigabyte->pdev->dev.kobj, NULL,
+					gigabyte_laptop_command_nodes[cmd]);
+			}
+		}
+		gigabyte_laptop_publish_status(gigabyte);
+		if (fan_mode != READ_ONCE(gigabyte->fan_mode) ||
+				gpu_boost != READ_ONCE(gigabyte->gpu_boost))
+			gigabyte_laptop_profile_notify(gigabyte);
+	}
+}
+
+/*
+ * Writing anything waits until every queued write has reached the EC, and
+ * returns the first error since the last sync.
+ */
+static ssize_t sync_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	int ret;
+
+	flush_work(&gigabyte->cmd_work);
+	ret = xchg(&gigabyte->cmd_error, 0);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * In-driver fan control.
+ * 0 = fans are managed by the EC or by fan_mode
+ * 1 = fans are driven by the driver using fan_control_curve (fixed mode)
+ */
+static ssize_t fan_control_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->fan_control_enabled));
+}
+
+static ssize_t fan_control_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&gigabyte->state_lock);
+	if (enable == gigabyte->fan_control_enabled) {
+		mutex_unlock(&gigabyte->state_lock);
+		return count;
+	}
+	if (enable && gigabyte_laptop_cooling_engaged(gigabyte)) {
+		mutex_unlock(&gigabyte->state_lock);
+		return -EBUSY;
+	}
+
+	if (enable) {
+		// The custom speed only takes effect in fixed mode.
+		gigabyte->fan_control_saved_mode = gigabyte->fan_mode;
+		gigabyte->fan_control_saved_speed = gigabyte->fan_custom_display_speed;
+		gigabyte->fan_control_temp = 0;
+		gigabyte->fan_control_speed = gigabyte->fan_custom_display_speed * 10;
+		gigabyte->fan_control_duty = 0;
+		gigabyte_laptop_post_command(gigabyte, CMD_FAN_MODE, 5);
+		WRITE_ONCE(gigabyte->fan_control_enabled, true);
+		mod_delayed_work(system_wq, &gigabyte->sensor_work, 0);
+	} else {
+		// Drop a duty still queued, and give back the custom speed it replaced.
+		WRITE_ONCE(gigabyte->fan_control_enabled, false);
+		spin_lock(&gigabyte->cmd_lock);
+		__clear_bit(CMD_FAN_DUTY, &gigabyte->cmd_pending);
+		spin_unlock(&gigabyte->cmd_lock);
+		gigabyte_laptop_post_command(gigabyte, CMD_FAN_SPEED,
+			gigabyte->fan_control_saved_speed);
+		gigabyte_laptop_post_command(gigabyte, CMD_FAN_MODE,
+			gigabyte->fan_control_saved_mode);
+	}
+	mutex_unlock(&gigabyte->state_lock);
+
+	// Applying the mode takes state_lock, so wait for it outside of it.
+	ret = gigabyte_laptop_kick_commands(gigabyte);
+	if (ret)
+		return ret;
+	return count;
+}
+
+/*
+ * Curve used by the in-driver fan control, as "temperature speed" pairs with
+ * the speed in percent. Between 2 and 16 points, in non-decreasing order.
+ */
+static ssize_t fan_control_curve_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct fan_control_data curve;
+	int len = 0;
 
-	ret = kstrtouint(buf, 0, &limit);
-	if (ret)
-		return ret;
+	spin_lock(&gigabyte->fan_control_lock);
+	curve = gigabyte->fan_control;
+	spin_unlock(&gigabyte->fan_control_lock);
 
-	if (limit > 100 || limit < 60) {
-		pr_err("Invalid charge limit\n");
+	for (int i = 0; i < curve.points; i++)
+		len += sysfs_emit_at(buf, len, "%d %d\n", curve.temperature[i], curve.speed[i]);
+	return len;
+}
+
+static ssize_t fan_control_curve_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	unsigned int temperature, speed;
+	struct fan_control_data curve = { 0 };
+	int n;
+
+	while (curve.points < FAN_CONTROL_POINTS &&
+			sscanf(buf, "%u %u%n", &temperature, &speed, &n) == 2) {
+		buf += n;
+		if (temperature > 100 || speed > 100) {
+			pr_err("Invalid fan control point %d\n", curve.points);
+			return -EINVAL;
+		}
+		if (curve.points && (temperature < curve.temperature[curve.points - 1] ||
+				speed < curve.speed[curve.points - 1])) {
+			pr_err("Fan control curve must be non-decreasing\n");
+			return -EINVAL;
+		}
+		curve.temperature[curve.points] = temperature;
+		curve.speed[curve.points] = speed;
+		curve.points++;
+	}
+
+	if (curve.points < 2) {
+		pr_err("Fan control curve needs at least 2 points\n");
 		return -EINVAL;
 	}
 
-	ret = gigabyte_laptop_set_devstate(CHARGING_LIMIT, limit, &output);
+	spin_lock(&gigabyte->fan_control_lock);
+	gigabyte->fan_control = curve;
+	spin_unlock(&gigabyte->fan_control_lock);
+	return count;
+}
+
+#define FAN_CONTROL_PARAM(_name, _min, _max) \
+static ssize_t fan_control_##_name##_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{ \
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev); \
+	return sysfs_emit(buf, "%d\n", READ_ONCE(gigabyte->fan_control_##_name)); \
+} \
+static ssize_t fan_control_##_name##_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count) \
+{ \
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev); \
+	unsigned int val; \
+	int ret; \
+	ret = kstrtouint(buf, 0, &val); \
+	if (ret) \
+		return ret; \
+	if (val < _min || val > _max) \
+		return -EINVAL; \
+	spin_lock(&gigabyte->fan_control_lock); \
+	gigabyte->fan_control_##_name = val; \
+	spin_unlock(&gigabyte->fan_control_lock); \
+	return count; \
+} \
+static DEVICE_ATTR_RW(fan_control_##_name);
+// Degrees a temperature must fall before the fans slow down.
+FAN_CONTROL_PARAM(hysteresis, 0, 20);
+// Largest speed change per sample, in percent.
+FAN_CONTROL_PARAM(ramp, 1, 100);
+
+static ssize_t battery_cycle_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	int ret, cyc1, cyc2;
+
+	ret = gigabyte_laptop_get_devstate(BATT_CYCLE, &cyc1);
+	if (ret)
+		return ret;
+	ret = gigabyte_laptop_get_devstate(BATT_CYCLE2, &cyc2);
 	if (ret)
 		return ret;
 
-	gigabyte = dev_get_drvdata(dev);
-	gigabyte->charge_limit = limit;
-	return count;
+	return sysfs_emit(buf, "%d\n", max(cyc1, cyc2));
 }
 
-static ssize_t gpu_boost_show(struct device *dev, struct device_attribute *attr, char *buf)
+static ssize_t debug_method_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	int ret;
+	u8 data;
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	ret = kstrtou8(buf, 0, &data);
+	if (ret)
+		return ret;
 
-	return sysfs_emit(buf, "%d\n", gigabyte->gpu_boost);
+	gigabyte = dev_get_drvdata(dev);
+	gigabyte->debug_method = data;
+	return count;
 }
 
-static ssize_t gpu_boost_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+static ssize_t debug_method_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
 	int ret, output;
-	unsigned int mode;
-	struct gigabyte_laptop_wmi *gigabyte;
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
 
-	ret = kstrtouint(buf, 0, &mode);
+	ret = gigabyte_laptop_get_devstate(gigabyte->debug_method, &output);
+	if (ret == -EMSGSIZE) {
+		u8 data[WMI_RESULT_BUFFER_SIZE];
+
+		ret = gigabyte_laptop_get_devstate_buffer(gigabyte->debug_method, 0, data, sizeof(data));
+		if (ret < 0)
+			return ret;
+		return sysfs_emit(buf, "%d, %*ph\n", gigabyte->debug_method, ret, data);
+	}
 	if (ret)
 		return ret;
+	return sysfs_emit(buf, "%d, %d\n", gigabyte->debug_method, output);
+}
 
-	// TODO: Check for AORUS laptops with 4 modes
-	if (mode > 3) {
-		pr_err("Invalid boost mode");
+#define TOGGLE_DEVICE(_device, _id) \
+static ssize_t _device##_toggle_show(struct device *dev, struct device_attribute *attr, char *buf) \
+{ \
+	int ret, output; \
+	ret = gigabyte_laptop_get_devstate(_id, &output); \
+	if (ret) \
+		return ret; \
+	return sysfs_emit(buf, "%d\n", output); \
+} \
+static DEVICE_ATTR_RO(_device##_toggle);
+TOGGLE_DEVICE(usb_charge_s3, USB_SLEEP);
+TOGGLE_DEVICE(usb_charge_s4, USB_HIBERNATE);
+
+static DEVICE_ATTR_RW(fan_mode);
+static DEVICE_ATTR_RW(fan_custom_speed);
+static DEVICE_ATTR_RW(charge_mode);
+static DEVICE_ATTR_RW(charge_limit);
+static DEVICE_ATTR_RW(gpu_boost);
+static DEVICE_ATTR_RW(fan_curve_index);
+static DEVICE_ATTR_RW(fan_curve_data);
+static DEVICE_ATTR_RW(fan_curve);
+static DEVICE_ATTR_RW(fan_control);
+static DEVICE_ATTR_RW(fan_control_curve);
+static DEVICE_ATTR_RO(battery_cycle);
+static DEVICE_ATTR_RW(debug_method);
+static DEVICE_ATTR_WO(sync);
+
+static struct attribute *gigabyte_laptop_attributes[] = {
+	&dev_attr_fan_mode.attr,
+	&dev_attr_fan_custom_speed.attr,
+	&dev_attr_charge_mode.attr,
+	&dev_attr_charge_limit.attr,
+	&dev_attr_usb_charge_s3_toggle.attr,
+	&dev_attr_usb_charge_s4_toggle.attr,
+	&dev_attr_gpu_boost.attr,
+	&dev_attr_fan_curve_index.attr,
+	&dev_attr_fan_curve_data.attr,
+	&dev_attr_fan_curve.attr,
+	&dev_attr_fan_control.attr,
+	&dev_attr_fan_control_curve.attr,
+	&dev_attr_fan_control_hysteresis.attr,
+	&dev_attr_fan_control_ramp.attr,
+	&dev_attr_battery_cycle.attr,
+	&dev_attr_debug_method.attr,
+	&dev_attr_sync.attr,
+	NULL
+};
+
+static umode_t gigabyte_laptop_sysfs_is_visible(struct kobject *kobj,
+					struct attribute *attr, int n)
+{
+	unsigned long cap;
+
+	if (attr == &dev_attr_charge_mode.attr || attr == &dev_attr_charge_limit.attr)
+		cap = GIGABYTE_LAPTOP_CAP_CHARGE;
+	else if (attr == &dev_attr_gpu_boost.attr)
+		cap = GIGABYTE_LAPTOP_CAP_GPU_BOOST;
+	else
+		return attr->mode;
+
+	return gigabyte_laptop_caps & cap ? attr->mode : 0;
+}
+
+static const struct attribute_group gigabyte_laptop_attr_group = {
+	.is_visible = gigabyte_laptop_sysfs_is_visible,
+	.attrs = gigabyte_laptop_attributes,
+};
+
+static const struct gigabyte_laptop_model aero_model = {
+	.ec_map = &aero_ec_map,
+	.caps = GIGABYTE_LAPTOP_CAPS_ALL,
+	.temp_channels = BIT(TEMP_MOTHERBOARD),
+};
+
+// GPU boost needs Dynamic Boost, which came with the Aero 15 X9.
+static const struct gigabyte_laptop_model intel_model = {
+	.caps = GIGABYTE_LAPTOP_CAP_CHARGE,
+};
+
+// Aero 14 W-series, see the methods marked as not supported by it.
+static const struct gigabyte_laptop_model aero_14_w_model = {
+	.caps = 0,
+};
+
+#define DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY(name, model) \
+	{ .matches = { \
+		DMI_EXACT_MATCH(DMI_BOARD_VENDOR, "GIGABYTE"), \
+		DMI_EXACT_MATCH(DMI_PRODUCT_FAMILY, name), \
+	}, .driver_data = (void *)(model) }
+
+#define DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE(name, model) \
+	{ .matches = { \
+		DMI_EXACT_MATCH(DMI_BOARD_VENDOR, "GIGABYTE"), \
+		DMI_EXACT_MATCH(DMI_PRODUCT_NAME, name), \
+	}, .driver_data = (void *)(model) }
+
+static const struct dmi_system_id gigabyte_laptop_known_working_platforms[] = {
+	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("AERO", &aero_model),
+	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("AORUS", &aero_model),
+	// For older Aero models
+	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("Intel", &intel_model),
+	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("Aero 14", &aero_14_w_model),
+	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("P64V6", &aero_14_w_model),
+	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("P64V7", &aero_14_w_model),
+	{ }
+};
+
+/* Thermal cooling devices ********************************/
+
+/*
+ * Each fan the driver can set on its own is a cooling device, with a state
+ * for each custom speed step, so thermal governors can drive it. State 0
+ * leaves the fan to the EC. Models without dual fan control have a single
+ * device, which drives both fans.
+ */
+static int gigabyte_laptop_cooling_get_max_state(struct thermal_cooling_device *cdev,
+					unsigned long *state)
+{
+	*state = ARRAY_SIZE(fan_speed_duty);
+	return 0;
+}
+
+static int gigabyte_laptop_cooling_get_cur_state(struct thermal_cooling_device *cdev,
+					unsigned long *state)
+{
+	struct gigabyte_laptop_cooling *cooling = cdev->devdata;
+
+	*state = READ_ONCE(cooling->state);
+	return 0;
+}
+
+static int gigabyte_laptop_cooling_set_cur_state(struct thermal_cooling_device *cdev,
+					unsigned long state)
+{
+	struct gigabyte_laptop_cooling *cooling = cdev->devdata;
+	struct gigabyte_laptop_wmi *gigabyte = cooling->gigabyte;
+
+	if (state > ARRAY_SIZE(fan_speed_duty))
 		return -EINVAL;
+
+	mutex_lock(&gigabyte->state_lock);
+	if (gigabyte->fan_control_enabled) {
+		mutex_unlock(&gigabyte->state_lock);
+		return -EBUSY;
+	}
+	if (state != cooling->state) {
+		WRITE_ONCE(cooling->state, state);
+		gigabyte_laptop_post_command(gigabyte, CMD_COOLING, 0);
 	}
+	mutex_unlock(&gigabyte->state_lock);
+	return 0;
+}
 
-	ret = gigabyte_laptop_set_devstate(GPU_QBOOST, mode, &output);
-	if (ret)
-		return ret;
+static const struct thermal_cooling_device_ops gigabyte_laptop_cooling_ops = {
+	.get_max_state = gigabyte_laptop_cooling_get_max_state,
+	.get_cur_state = gigabyte_laptop_cooling_get_cur_state,
+	.set_cur_state = gigabyte_laptop_cooling_set_cur_state,
+};
 
-	gigabyte = dev_get_drvdata(dev);
-	gigabyte->gpu_boost = mode;
-	return count;
+// Needs dual fan control to be known. Failing to register is not fatal.
+static void gigabyte_laptop_cooling_register(struct gigabyte_laptop_wmi *gigabyte)
+{
+	static const char * const types[COOLING_FANS] = { "aorus-cpu-fan", "aorus-gpu-fan" };
+	int fans = gigabyte->dual_fan_speed_enabled ? COOLING_FANS : 1;
+	struct thermal_cooling_device *cdev;
+
+	for (int i = 0; i < fans; i++) {
+		gigabyte->cooling[i].gigabyte = gigabyte;
+		cdev = thermal_cooling_device_register(fans > 1 ? types[i] : "aorus-fan",
+				&gigabyte->cooling[i], &gigabyte_laptop_cooling_ops);
+		if (IS_ERR(cdev)) {
+			pr_err("Cooling device registration failed with %ld\n", PTR_ERR(cdev));
+			continue;
+		}
+		gigabyte->cooling[i].cdev = cdev;
+	}
 }
 
-static ssize_t fan_curve_index_show(struct device *dev, struct device_attribute *attr, char *buf)
+static void gigabyte_laptop_cooling_unregister(struct gigabyte_laptop_wmi *gigabyte)
+{
+	for (int i = 0; i < COOLING_FANS; i++)
+		if (gigabyte->cooling[i].cdev)
+			thermal_cooling_device_unregister(gigabyte->cooling[i].cdev);
+}
+
+/* Platform profile ***************************************/
+
+/*
+ * Each profile sets the fan mode and, where supported, GPU boost. A profile
+ * is applied in one go under state_lock, and only knobs that differ from
+ * the profile are written. Any other combination reads back as custom.
+ */
+struct gigabyte_laptop_profile {
+	enum platform_profile_option option;
+	int fan_mode;
+	int gpu_boost;
+};
+
+static const struct gigabyte_laptop_profile gigabyte_laptop_profiles[] = {
+	{ PLATFORM_PROFILE_QUIET, 1, 0 },
+	{ PLATFORM_PROFILE_BALANCED, 0, 0 },
+	{ PLATFORM_PROFILE_PERFORMANCE, 2, 1 },
+};
+
+static bool gigabyte_laptop_profile_has_gpu_boost(void)
+{
+	return READ_ONCE(gigabyte_laptop_caps) & GIGABYTE_LAPTOP_CAP_GPU_BOOST;
+}
+
+static int gigabyte_laptop_profile_probe(void *drvdata, unsigned long *choices)
+{
+	for (int i = 0; i < ARRAY_SIZE(gigabyte_laptop_profiles); i++)
+		set_bit(gigabyte_laptop_profiles[i].option, choices);
+	return 0;
+}
+
+static int gigabyte_laptop_profile_get(struct device *dev, enum platform_profile_option *option)
 {
 	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	const struct gigabyte_laptop_profile *profile;
+
+	for (int i = 0; i < ARRAY_SIZE(gigabyte_laptop_profiles); i++) {
+		profile = &gigabyte_laptop_profiles[i];
+		if (READ_ONCE(gigabyte->fan_mode) != profile->fan_mode)
+			continue;
+		if (gigabyte_laptop_profile_has_gpu_boost() &&
+				READ_ONCE(gigabyte->gpu_boost) != profile->gpu_boost)
+			continue;
+
+		*option = profile->option;
+		return 0;
+	}
 
-	return sysfs_emit(buf, "%d\n", gigabyte->fan_curve_index);
+	*option = PLATFORM_PROFILE_CUSTOM;
+	return 0;
 }
 
-static ssize_t fan_curve_index_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/*
+ * Called under state_lock. Applies a command right away, unless it's a no-op.
+ * Not inlined, so that _RET_IP_ is profile_set.
+ */
+static noinline int gigabyte_laptop_profile_apply(struct gigabyte_laptop_wmi *gigabyte,
+					enum gigabyte_laptop_command cmd, int current_value, int value)
 {
 	int ret;
-	unsigned int index;
-	struct gigabyte_laptop_wmi *gigabyte;
 
-	ret = kstrtouint(buf, 0, &index);
-	if (ret)
-		return ret;
+	if (current_value == value)
+		return 0;
 
-	if (index >= FAN_CURVE_POINTS) {
-		pr_err("Invalid fan curve index\n");
-		return -EINVAL;
+	ret = gigabyte_laptop_commands[cmd](gigabyte, value, _RET_IP_);
+	if (!ret)
+		sysfs_notify(&gigabyte->pdev->dev.kobj, NULL, gigabyte_laptop_command_nodes[cmd]);
+	return ret;
+}
+
+static int gigabyte_laptop_profile_set(struct device *dev, enum platform_profile_option option)
+{
+	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	const struct gigabyte_laptop_profile *profile = NULL;
+	int ret, fan_mode, gpu_boost;
+
+	for (int i = 0; i < ARRAY_SIZE(gigabyte_laptop_profiles); i++)
+		if (gigabyte_laptop_profiles[i].option == option)
+			profile = &gigabyte_laptop_profiles[i];
+	if (!profile)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&gigabyte->state_lock);
+	if (gigabyte->fan_control_enabled || gigabyte_laptop_cooling_engaged(gigabyte)) {
+		mutex_unlock(&gigabyte->state_lock);
+		return -EBUSY;
 	}
 
-	gigabyte = dev_get_drvdata(dev);
-	gigabyte->fan_curve_index = index;
-	return count;
+	/*
+	 * Lower GPU boost before slowing the fans down, and speed the fans up
+	 * before raising it, so the fans always keep up with the power limit.
+	 */
+	fan_mode = gigabyte->fan_mode;
+	gpu_boost = gigabyte->gpu_boost;
+	if (!gigabyte_laptop_profile_has_gpu_boost() || profile->gpu_boost >= gpu_boost) {
+		ret = gigabyte_laptop_profile_apply(gigabyte, CMD_FAN_MODE, fan_mode, profile->fan_mode);
+		if (!ret && gigabyte_laptop_profile_has_gpu_boost())
+			ret = gigabyte_laptop_profile_apply(gigabyte, CMD_GPU_BOOST, gpu_boost,
+					profile->gpu_boost);
+	} else {
+		ret = gigabyte_laptop_profile_apply(gigabyte, CMD_GPU_BOOST, gpu_boost,
+				profile->gpu_boost);
+		if (!ret)
+			ret = gigabyte_laptop_profile_apply(gigabyte, CMD_FAN_MODE, fan_mode,
+					profile->fan_mode);
+	}
+	mutex_unlock(&gigabyte->state_lock);
+
+	gigabyte_laptop_publish_status(gigabyte);
+	return ret;
 }
 
-static ssize_t fan_curve_data_show(struct device *dev, struct device_attribute *attr, char *buf)
+static const struct platform_profile_ops gigabyte_laptop_profile_ops = {
+	.probe = gigabyte_laptop_profile_probe,
+	.profile_get = gigabyte_laptop_profile_get,
+	.profile_set = gigabyte_laptop_profile_set,
+};
+
+// Failing to register is not fatal, e.g. when another driver already did.
+static void gigabyte_laptop_profile_register(struct gigabyte_laptop_wmi *gigabyte)
 {
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
-	int index = gigabyte->fan_curve_index;
+	struct device *ppdev;
+
+	ppdev = platform_profile_register(&gigabyte->pdev->dev, GIGABYTE_LAPTOP_FILE, gigabyte,
+			&gigabyte_laptop_profile_ops);
+	if (IS_ERR(ppdev)) {
+		pr_err("Platform profile registration failed with %ld\n", PTR_ERR(ppdev));
+		return;
+	}
 
-	return sysfs_emit(buf, "%d %d\n", gigabyte->fan_curve.temperature[index],
-		gigabyte->fan_curve.speed[index]);
+	mutex_lock(&gigabyte->profile_lock);
+	gigabyte->ppdev = ppdev;
+	mutex_unlock(&gigabyte->profile_lock);
 }
 
-static ssize_t fan_curve_data_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+static void gigabyte_laptop_profile_unregister(struct gigabyte_laptop_wmi *gigabyte)
 {
-	int ret, output;
-	u16 data;
-	u32 payload;
-	struct gigabyte_laptop_wmi *gigabyte;
+	struct device *ppdev;
 
-	ret = kstrtou16(buf, 0, &data);
-	if (ret)
-		return ret;
+	mutex_lock(&gigabyte->profile_lock);
+	ppdev = gigabyte->ppdev;
+	gigabyte->ppdev = NULL;
+	mutex_unlock(&gigabyte->profile_lock);
 
-	gigabyte = dev_get_drvdata(dev);
-	// likely payload: speed, temp, index
-	//payload = gigabyte->fan_curve.speed[gigabyte->fan_curve_index] << 16 | gigabyte->fan_curve.temperature[gigabyte->fan_curve_index] << 8 | (u8) gigabyte->fan_curve_index;
-	payload = data << 8 | gigabyte->fan_curve_index;
+	if (ppdev)
+		platform_profile_remove(ppdev);
+}
+
+/* Character device ***************************************/
+
+/*
+ * /dev/aorus_laptop takes batches of operations, so a control daemon can
+ * refresh everything it shows in one syscall. The whole batch runs under
+ * state_lock. Only the methods below can be used, and only by root or with
+ * the node opened for writing.
+ */
+static bool gigabyte_laptop_batch_get_allowed(u8 method)
+{
+	switch (method) {
+		case GPU_QBOOST:
+		case FAN_SILENT_MODE:
+		case CHARGING_MODE:
+		case CHARGING_LIMIT:
+		case FAN_CUSTOM_MODE:
+		case FAN_FIXED_MODE:
+		case FAN_CUSTOM_SPEED:
+		case BATT_CYCLE2:
+		case BATT_CYCLE:
+		case FAN_GAMING_MODE:
+		case USB_SLEEP:
+		case USB_HIBERNATE:
+		case TEMP_CPU:
+		case TEMP_GPU:
+		case TEMP_GPU2:
+		case FAN_CPU_RPM:
+		case FAN_GPU_RPM:
+		case FAN_THREE_RPM:
+		case FAN_FOUR_RPM:
+		case FAN_SILENT_OLD:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Reading a fan curve point through WMBC writes the index to the EC and
+ * sleeps for 100 ms, so points are served from the cached curve instead.
+ */
+static int gigabyte_laptop_batch_get(struct gigabyte_laptop_wmi *gigabyte, u8 method, u32 arg,
+					int *value, unsigned long caller)
+{
+	if (method == FAN_INDEX_VALUE) {
+		if (arg >= FAN_CURVE_POINTS)
+			return -EINVAL;
+		*value = fan_curve_point(gigabyte->fan_curve.temperature[arg], gigabyte->fan_curve.speed[arg]);
+		return 0;
+	}
+
+	if (!gigabyte_laptop_batch_get_allowed(method))
+		return -EPERM;
+	return __gigabyte_laptop_get_devstate2(method, arg, value, caller);
+}
+
+// Sets are checked like their sysfs node and applied like a queued write.
+static int gigabyte_laptop_batch_set(struct gigabyte_laptop_wmi *gigabyte, u8 method, u32 arg,
+					unsigned long caller)
+{
+	enum gigabyte_laptop_command cmd;
+	int ret;
+
+	switch (method) {
+		case CHARGING_MODE:
+			if (arg > 1)
+				return -EINVAL;
+			cmd = CMD_CHARGE_MODE;
+			break;
+		case CHARGING_LIMIT:
+			if (arg < 60 || arg > 100)
+				return -EINVAL;
+			cmd = CMD_CHARGE_LIMIT;
+			break;
+		case GPU_QBOOST:
+			if (arg > 3)
+				return -EINVAL;
+			cmd = CMD_GPU_BOOST;
+			break;
+		case FAN_CUSTOM_SPEED:
+			if (!fan_speed_valid(arg))
+				return -EINVAL;
+			if (gigabyte->fan_control_enabled || gigabyte_laptop_cooling_engaged(gigabyte))
+				return -EBUSY;
+			cmd = CMD_FAN_SPEED;
+			break;
+		default:
+			return -EPERM;
+	}
+
+	ret = gigabyte_laptop_commands[cmd](gigabyte, arg, caller);
+	if (!ret)
+		sysfs_notify(&gigabyte->pdev->dev.kobj, NULL, gigabyte_laptop_command_nodes[cmd]);
+	return ret;
+}
+
+/*
+ * Runs a batch already copied in. Nothing in here touches user memory. Not
+ * inlined, so that _RET_IP_ is the ioctl.
+ */
+static noinline void gigabyte_laptop_batch(struct gigabyte_laptop_wmi *gigabyte, struct file *file,
+					struct aorus_laptop_op *ops, u32 count)
+{
+	unsigned long caller = _RET_IP_;
+	struct aorus_laptop_op *op;
+	int ret, output, gpu_boost;
+
+	// The fan curve and dual fan control are only known after this.
+	flush_work(&gigabyte->probe_work);
+
+	mutex_lock(&gigabyte->state_lock);
+	gpu_boost = gigabyte->gpu_boost;
+	for (op = ops; op < ops + count; op++) {
+		op->value = 0;
+		if (op->reserved) {
+			op->error = -EINVAL;
+		} else if (op->type == AORUS_LAPTOP_OP_GET) {
+			ret = gigabyte_laptop_batch_get(gigabyte, op->method, op->arg, &output,
+					caller);
+			op->error = ret;
+			if (!ret)
+				op->value = output;
+		} else if (op->type == AORUS_LAPTOP_OP_SET) {
+			if (file->f_mode & FMODE_WRITE)
+				op->error = gigabyte_laptop_batch_set(gigabyte, op->method, op->arg,
+					caller);
+			else
+				op->error = -EBADF;
+		} else {
+			op->error = -EINVAL;
+		}
+	}
+	mutex_unlock(&gigabyte->state_lock);
+	gigabyte_laptop_publish_status(gigabyte);
+	if (gpu_boost != READ_ONCE(gigabyte->gpu_boost))
+		gigabyte_laptop_profile_notify(gigabyte);
+}
+
+/*
+ * ->mmap runs with mmap_lock held, and the ioctl takes bind_lock around code
+ * that can fault, so ->mmap must not take bind_lock. Each open file pins the
+ * status page instead, and mappings are made from that reference.
+ */
+static int gigabyte_laptop_open(struct inode *inode, struct file *file)
+{
+	struct page *page = NULL;
+
+	mutex_lock(&gigabyte_laptop_bind_lock);
+	if (platform_device) {
+		struct gigabyte_laptop_wmi *gigabyte = platform_get_drvdata(platform_device);
 
-	ret = gigabyte_laptop_set_devstate(FAN_INDEX_VALUE, payload, &output);
-	if (ret)
-		return ret;
+		page = gigabyte->status_page;
+		get_page(page);
+	}
+	mutex_unlock(&gigabyte_laptop_bind_lock);
 
-	gigabyte->fan_curve.temperature[gigabyte->fan_curve_index] = data;
-	gigabyte->fan_curve.speed[gigabyte->fan_curve_index] = data >> 8;
-	return count;
+	file->private_data = page;
+	return 0;
 }
 
-static ssize_t battery_cycle_show(struct device *dev, struct device_attribute *attr, char *buf)
+static int gigabyte_laptop_release(struct inode *inode, struct file *file)
 {
-	int ret, cyc1, cyc2;
-
-	ret = gigabyte_laptop_get_devstate(BATT_CYCLE, &cyc1);
-	if (ret)
-		return ret;
-	ret = gigabyte_laptop_get_devstate(BATT_CYCLE2, &cyc2);
-	if (ret)
-		return ret;
+	struct page *page = file->private_data;
 
-	return sysfs_emit(buf, "%d\n", max(cyc1, cyc2));
+	if (page)
+		put_page(page);
+	return 0;
 }
 
-static ssize_t debug_method_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+// Map the status page. It is shared by everyone, so it can't be written to.
+static int gigabyte_laptop_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	int ret;
-	u8 data;
-	struct gigabyte_laptop_wmi *gigabyte;
+	struct page *page = file->private_data;
 
-	ret = kstrtou8(buf, 0, &data);
-	if (ret)
-		return ret;
+	if (!page)
+		return -ENODEV;
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE ||
+			vma->vm_flags & VM_WRITE)
+		return -EINVAL;
+	vm_flags_clear(vma, VM_MAYWRITE);
 
-	gigabyte = dev_get_drvdata(dev);
-	gigabyte->debug_method = data;
-	return count;
+	// The mapping holds its own reference to the page.
+	return vm_insert_page(vma, vma->vm_start, page);
 }
 
-static ssize_t debug_method_show(struct device *dev, struct device_attribute *attr, char *buf)
+/*
+ * Copying from and to user memory can fault, and take mmap_lock, so it is
+ * done with no lock held. A slow user buffer then only stalls its own caller.
+ */
+static long gigabyte_laptop_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-	int ret, output;
-	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
-
-	ret = gigabyte_laptop_get_devstate(gigabyte->debug_method, &output);
-	if (ret)
-		return ret;
-	return sysfs_emit(buf, "%d, %d\n", gigabyte->debug_method, output);
-}
+	struct aorus_laptop_batch __user *argp = (struct aorus_laptop_batch __user *)arg;
+	struct aorus_laptop_batch batch;
+	struct aorus_laptop_op *ops;
+	long ret = 0;
+
+	if (cmd != AORUS_LAPTOP_IOC_BATCH)
+		return -ENOTTY;
+	if (!(file->f_mode & FMODE_WRITE) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	if (batch.flags || !batch.count || batch.count > AORUS_LAPTOP_BATCH_MAX)
+		return -EINVAL;
 
-#define TOGGLE_DEVICE(_device, _id) \
-static ssize_t _device##_toggle_show(struct device *dev, struct device_attribute *attr, char *buf) \
-{ \
-	int ret, output; \
-	ret = gigabyte_laptop_get_devstate(_id, &output); \
-	if (ret) \
-		return ret; \
-	return sysfs_emit(buf, "%d\n", output); \
-} \
-static DEVICE_ATTR_RO(_device##_toggle);
-TOGGLE_DEVICE(usb_charge_s3, USB_SLEEP);
-TOGGLE_DEVICE(usb_charge_s4, USB_HIBERNATE);
+	ops = memdup_user(u64_to_user_ptr(batch.ops), batch.count * sizeof(*ops));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
 
-static DEVICE_ATTR_RW(fan_mode);
-static DEVICE_ATTR_RW(fan_custom_speed);
-static DEVICE_ATTR_RW(charge_mode);
-static DEVICE_ATTR_RW(charge_limit);
-static DEVICE_ATTR_RW(gpu_boost);
-static DEVICE_ATTR_RW(fan_curve_index);
-static DEVICE_ATTR_RW(fan_curve_data);
-static DEVICE_ATTR_RO(battery_cycle);
-static DEVICE_ATTR_RW(debug_method);
+	/*
+	 * Make sure the results can be copied back before any set is applied.
+	 * access_ok() only checks the range, so write the ops back unchanged.
+	 */
+	if (copy_to_user(u64_to_user_ptr(batch.ops), ops, batch.count * sizeof(*ops))) {
+		kfree(ops);
+		return -EFAULT;
+	}
 
-static struct attribute *gigabyte_laptop_attributes[] = {
-	&dev_attr_fan_mode.attr,
-	&dev_attr_fan_custom_speed.attr,
-	&dev_attr_charge_mode.attr,
-	&dev_attr_charge_limit.attr,
-	&dev_attr_usb_charge_s3_toggle.attr,
-	&dev_attr_usb_charge_s4_toggle.attr,
-	&dev_attr_gpu_boost.attr,
-	&dev_attr_fan_curve_index.attr,
-	&dev_attr_fan_curve_data.attr,
-	&dev_attr_battery_cycle.attr,
-	&dev_attr_debug_method.attr,
-	NULL
-};
+	// The device node can outlive the WMI devices it was created for.
+	mutex_lock(&gigabyte_laptop_bind_lock);
+	if (platform_device)
+		gigabyte_laptop_batch(platform_get_drvdata(platform_device), file, ops, batch.count);
+	else
+		ret = -ENODEV;
+	mutex_unlock(&gigabyte_laptop_bind_lock);
+
+	if (!ret && copy_to_user(u64_to_user_ptr(batch.ops), ops, batch.count * sizeof(*ops)))
+		ret = -EFAULT;
+	kfree(ops);
+	return ret;
+}
 
-static const struct attribute_group gigabyte_laptop_attr_group = {
-	//.is_visible = gigabyte_laptop_sysfs_is_visible,
-	.attrs = gigabyte_laptop_attributes,
+static const struct file_operations gigabyte_laptop_fops = {
+	.owner = THIS_MODULE,
+	.open = gigabyte_laptop_open,
+	.release = gigabyte_laptop_release,
+	.unlocked_ioctl = gigabyte_laptop_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap = gigabyte_laptop_mmap,
 };
 
-#define DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY(name) \
-	{ .matches = { \
-		DMI_EXACT_MATCH(DMI_BOARD_VENDOR, "GIGABYTE"), \
-		DMI_EXACT_MATCH(DMI_PRODUCT_FAMILY, name), \
-	}}
-
-#define DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE(name) \
-	{ .matches = { \
-		DMI_EXACT_MATCH(DMI_BOARD_VENDOR, "GIGABYTE"), \
-		DMI_EXACT_MATCH(DMI_PRODUCT_NAME, name), \
-	}}
-
-static const struct dmi_system_id gigabyte_laptop_known_working_platforms[] = {
-	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("AERO"),
-	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("AORUS"),
-	// For older Aero models
-	DMI_EXACT_MATCH_GIGABYTE_LAPTOP_FAMILY("Intel"),
-	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("Aero 14"),
-	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("P64V6"),
-	DMI_EXACT_MATCH_GIGABYTE_LEGACY_DEVICE("P64V7"),
-	{ }
+// Anyone can map the status page. Batches need write access or root.
+static struct miscdevice gigabyte_laptop_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = GIGABYTE_LAPTOP_FILE,
+	.fops = &gigabyte_laptop_fops,
+	.mode = 0644,
 };
 
 /* Driver init ********************************************/
 
-static int probe_custom_fan_speed(int speed)
-{
-	if (speed == 0x39)
-		return 25;
-	else if (speed == 0x44)
-		return 30;
-	else if (speed == 0x50)
-		return 35;
-	else if (speed == 0x5B)
-		return 40;
-	else if (speed == 0x67)
-		return 45;
-	else if (speed == 0x72)
-		return 50;
-	else if (speed == 0x7D)
-		return 55;
-	else if (speed == 0x89)
-		return 60;
-	else if (speed == 0x94)
-		return 65;
-	else if (speed == 0xA0)
-		return 70;
-	else if (speed == 0xAB)
-		return 75;
-	else if (speed == 0xB7)
-		return 80;
-	else if (speed == 0xC2)
-		return 85;
-	else if (speed == 0xCE)
-		return 90;
-	else if (speed == 0xD9)
-		return 95;
-	else if (speed == 0xE5)
-		return 100;
-	else // For something like 0x5D, which is unknown
-		return 40;
-}
-
 static int gigabyte_laptop_probe(struct device *dev)
 {
-	int ret, output;
-	u8 result, result2;
 	struct gigabyte_laptop_wmi *gigabyte = dev_get_drvdata(dev);
+	struct gigabyte_laptop_probe_state state = {
+		.charge = gigabyte_laptop_caps & GIGABYTE_LAPTOP_CAP_CHARGE,
+	};
+	int ret;
+
+	ret = gigabyte_laptop_probe_state(&gigabyte_laptop_fw_ops,
+			gigabyte_laptop_fw_caller(_THIS_IP_), &state);
+	if (ret)
+		return ret;
 
-	// Older devices are using a different method ID for silent fan mode.
-	// In that case, newer devices won't return anything when using that ID.
-	ret = gigabyte_laptop_get_devstate(FAN_SILENT_OLD, &output);
-	if (output < 0) { // -1 on newer devices
+	gigabyte->fan_silent_method = state.silent_method;
+	if (gigabyte->fan_silent_method == FAN_SILENT_MODE)
 		pr_info("Newer model detected, using new silent fan mode ID");
-		gigabyte->fan_silent_method = FAN_SILENT_MODE;
-	}
-	else { // 0 on older devices
+	else
 		pr_info("Older model detected, using old ID");
-		gigabyte->fan_silent_method = FAN_SILENT_OLD;
-	}
 
 	// Set silent fan mode ID.
 	fan_modes[1] = gigabyte->fan_silent_method;
+	gigabyte->fan_mode = state.fan_mode;
 
-	// Get current fan mode.
-	ret = gigabyte_laptop_get_devstate(gigabyte->fan_silent_method, &output);
-	if (ret)
-		return ret;
-	else if (output) {
-		gigabyte->fan_mode = 1;
-		goto obtain_custom_fan_speed;
-	}
-	ret = gigabyte_laptop_get_devstate(FAN_GAMING_MODE, &output);
-	if (ret)
-		return ret;
-	else if (output) {
-		gigabyte->fan_mode = 2;
-		goto obtain_custom_fan_speed;
-	}
-	ret = gigabyte_laptop_get_devstate(FAN_CUSTOM_MODE, &output);
-	if (ret)
-		return ret;
-	else if (output) {
-		// Auto-maximum mode can't be read through WMI, so read EC register containing it
-		ret = ec_read(0xD, &result);
-		if (ret)
-			return AE_ERROR;
-		output = (result >> 7) & 0x1;
-		if (output) {
-			gigabyte->fan_mode = 4;
-			goto obtain_custom_fan_speed;
-		}
-		ret = gigabyte_laptop_get_devstate(FAN_FIXED_MODE, &output);
-		if (ret)
-			return ret;
-		else if (output)
-			gigabyte->fan_mode = 5;
-		else
-			gigabyte->fan_mode = 3;
-		goto obtain_custom_fan_speed;
+	if (state.custom_speed) {
+		gigabyte->fan_custom_display_speed = fan_duty_to_speed(state.custom_speed);
+		gigabyte->fan_custom_internal_speed = state.custom_speed;
 	}
-	// If all checks return 0, we are most likely in normal fan mode
-	gigabyte->fan_mode = 0;
 
-obtain_custom_fan_speed:
-	ret = gigabyte_laptop_get_devstate(FAN_CUSTOM_SPEED, &output);
-	if (ret)
-		return ret;
-	else if (output) {
-		gigabyte->fan_custom_display_speed = probe_custom_fan_speed(output);
-		gigabyte->fan_custom_internal_speed = output;
+	if (gigabyte_laptop_caps & GIGABYTE_LAPTOP_CAP_CHARGE && !state.charge) {
+		pr_info("Charging control not supported\n");
+		gigabyte_laptop_caps &= ~GIGABYTE_LAPTOP_CAP_CHARGE;
 	}
+	gigabyte->charge_mode = state.charge_mode;
+	if (state.charge_limit)
+		gigabyte->charge_limit = state.charge_limit;
+	return 0;
+}
 
-	/*
-		Some newer models don't change both fans' speed together through
-		FAN_CUSTOM_SPEED. If this is the case, we will have to modify FAN2
-		directly using ec_write. Doing it through WMI would be better if
-		we did not also have to modify GFTY as well, which already changes
-		on its own without us doing anything.
-	*/
-	ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED, 255, &output);
-	ec_read(0xB0, &result);
-	ec_read(0xB1, &result2);
-	if (result != result2) {
+/*
+ * Everything that is not needed to publish the initial state runs here, off
+ * the module load path. Anything depending on it must flush probe_work first.
+ */
+static void gigabyte_laptop_probe_deferred(struct work_struct *work)
+{
+	struct gigabyte_laptop_wmi *gigabyte = container_of(work,
+			struct gigabyte_laptop_wmi, probe_work);
+	int ret, output;
+
+	mutex_lock(&gigabyte->state_lock);
+	if (gigabyte_laptop_probe_dual_fan(&gigabyte_laptop_fw_ops,
+			gigabyte_laptop_fw_caller(_THIS_IP_), gigabyte->fan_custom_internal_speed)) {
 		pr_info("Dual fan speed control required\n");
 		gigabyte->dual_fan_speed_enabled = 1;
 	}
-	ret = gigabyte_laptop_set_devstate(FAN_CUSTOM_SPEED,
-		gigabyte->fan_custom_internal_speed, &output);
+	mutex_unlock(&gigabyte->state_lock);
 
-	ret = gigabyte_laptop_get_devstate(CHARGING_MODE, &output);
-	if (ret)
-		return ret;
-	else if (output)
-		gigabyte->charge_mode = output >> 2;
+	gigabyte_laptop_verify_ec_map(gigabyte);
+	gigabyte_laptop_discover_sensors(gigabyte);
 
-	ret = gigabyte_laptop_get_devstate(CHARGING_LIMIT, &output);
-	if (ret)
-		return ret;
-	else if (output)
-		gigabyte->charge_limit = output;
+	// Start sampling now that the EC map and channels are settled.
+	gigabyte_laptop_sample_sensors(gigabyte);
+	gigabyte_laptop_publish_status(gigabyte);
+	schedule_delayed_work(&gigabyte->sensor_work,
+			msecs_to_jiffies(gigabyte->update_interval));
+
+	gigabyte_laptop_hwmon_init(gigabyte);
+	gigabyte->hwmon_dev = hwmon_device_register_with_info(&gigabyte->pdev->dev,
+			GIGABYTE_LAPTOP_FILE, gigabyte, &gigabyte->chip_info, NULL);
+	if (IS_ERR(gigabyte->hwmon_dev)) {
+		pr_err("hwmon registration failed with %ld\n", PTR_ERR(gigabyte->hwmon_dev));
+		gigabyte->hwmon_dev = NULL;
+	}
+	gigabyte_laptop_cooling_register(gigabyte);
 
 	// Get the fan curve. Used by custom mode.
+	mutex_lock(&gigabyte->state_lock);
 	for (u8 i = 0; i < FAN_CURVE_POINTS; i++) {
 		ret = gigabyte_laptop_get_devstate2(FAN_INDEX_VALUE, i, &output);
-		if (ret)
-			return ret;
-		else if (output) {
-			gigabyte->fan_curve.temperature[i] = output;
-			gigabyte->fan_curve.speed[i] = output >> 8;
+		if (ret) {
+			pr_err("Unable to read fan curve point %u: %d\n", i, ret);
+			break;
+		} else if (output) {
+			write_seqcount_begin(&gigabyte->state_seq);
+			fan_curve_point_unpack(output, &gigabyte->fan_curve.temperature[i],
+				&gigabyte->fan_curve.speed[i]);
+			write_seqcount_end(&gigabyte->state_seq);
 		}
 	}
+	mutex_unlock(&gigabyte->state_lock);
 
-	return 0;
+	/*
+	 * Registered last, so profile_set never has to wait for this work. It
+	 * runs under the platform_profile core's lock, and flushing from there
+	 * would deadlock with this registration.
+	 */
+	gigabyte_laptop_profile_register(gigabyte);
 }
 
 static struct platform_driver platform_driver = {
@@ -918,56 +3143,113 @@ static struct platform_driver platform_driver = {
 	},
 };
 
-static void __exit gigabyte_laptop_exit(void)
+static const struct dmi_system_id *gigabyte_laptop_dmi_id;
+
+static struct gigabyte_laptop_wmi *gigabyte_laptop_alloc(const struct gigabyte_laptop_model *model)
+{
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	gigabyte = kzalloc(sizeof(struct gigabyte_laptop_wmi), GFP_KERNEL);
+	if (!gigabyte)
+		return NULL;
+
+	static_assert(sizeof(struct aorus_laptop_status) <= PAGE_SIZE);
+	gigabyte->status_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!gigabyte->status_page) {
+		kfree(gigabyte);
+		return NULL;
+	}
+	gigabyte->status = page_address(gigabyte->status_page);
+
+	gigabyte->telemetry = kvcalloc(TELEMETRY_RECORDS, sizeof(*gigabyte->telemetry), GFP_KERNEL);
+	if (!gigabyte->telemetry) {
+		__free_page(gigabyte->status_page);
+		kfree(gigabyte);
+		return NULL;
+	}
+
+	gigabyte->update_interval = clamp_val(update_interval, 100, 60000);
+	gigabyte->model = model;
+	if (ec_fast_path && model->ec_map)
+		gigabyte->ec_map = *model->ec_map;
+	else
+		gigabyte->ec_map = default_ec_map;
+	seqlock_init(&gigabyte->sensor_seqlock);
+	spin_lock_init(&gigabyte->status_lock);
+	spin_lock_init(&gigabyte->telemetry_lock);
+	init_waitqueue_head(&gigabyte->telemetry_wait);
+	INIT_DELAYED_WORK(&gigabyte->sensor_work, gigabyte_laptop_sensor_work);
+	INIT_WORK(&gigabyte->probe_work, gigabyte_laptop_probe_deferred);
+	// Nothing has been sampled yet.
+	for (int i = 0; i < TEMP_CHANNELS; i++)
+		gigabyte->sensors.temp_ret[i] = -ENODATA;
+	for (int i = 0; i < FAN_CHANNELS; i++)
+		gigabyte->sensors.fan_ret[i] = -ENODATA;
+	mutex_init(&gigabyte->state_lock);
+	seqcount_mutex_init(&gigabyte->state_seq, &gigabyte->state_lock);
+	mutex_init(&gigabyte->profile_lock);
+	spin_lock_init(&gigabyte->cmd_lock);
+	spin_lock_init(&gigabyte->fan_control_lock);
+	gigabyte->fan_control = default_fan_control;
+	gigabyte->fan_control_hysteresis = 3;
+	gigabyte->fan_control_ramp = 5;
+	INIT_WORK(&gigabyte->cmd_work, gigabyte_laptop_cmd_work);
+	return gigabyte;
+}
+
+static void gigabyte_laptop_free(struct gigabyte_laptop_wmi *gigabyte)
+{
+	kvfree(gigabyte->telemetry);
+	__free_page(gigabyte->status_page);
+	kfree(gigabyte);
+}
+
+static void gigabyte_laptop_teardown(void)
 {
 	struct gigabyte_laptop_wmi *gigabyte;
 
 	pr_info("Goodbye, World!\n");
 	gigabyte = platform_get_drvdata(platform_device);
-	hwmon_device_unregister(gigabyte->hwmon_dev);
+	cancel_work_sync(&gigabyte->probe_work);
+	// Let blocked telemetry readers go, so debugfs removal doesn't wait on them.
+	WRITE_ONCE(gigabyte->telemetry_closed, true);
+	wake_up_interruptible_all(&gigabyte->telemetry_wait);
+	debugfs_remove_recursive(gigabyte->debugfs);
+	// Everything that can queue work goes away before the work is cancelled.
+	if (gigabyte->hwmon_dev)
+		hwmon_device_unregister(gigabyte->hwmon_dev);
+	gigabyte_laptop_cooling_unregister(gigabyte);
+	gigabyte_laptop_profile_unregister(gigabyte);
+	misc_deregister(&gigabyte_laptop_miscdev);
 	sysfs_remove_group(&gigabyte->pdev->dev.kobj, &gigabyte_laptop_attr_group);
-	platform_driver_unregister(&platform_driver);
+	// The sensor work posts fan control commands, so it is stopped first.
+	cancel_delayed_work_sync(&gigabyte->sensor_work);
+	cancel_work_sync(&gigabyte->cmd_work);
 	platform_device_unregister(gigabyte->pdev);
-	kfree(gigabyte);
+	platform_device = NULL;
+	gigabyte_laptop_free(gigabyte);
 }
 
-static int __init gigabyte_laptop_init(void)
+static int gigabyte_laptop_setup(void)
 {
+	const struct gigabyte_laptop_model *model = gigabyte_laptop_dmi_id->driver_data;
 	struct gigabyte_laptop_wmi *gigabyte;
+	ktime_t start = ktime_get();
 	int result;
 
-	if (!wmi_has_guid(WMI_METHOD_WMBC) ||
-		!wmi_has_guid(WMI_METHOD_WMBD)) {
-		pr_warn("No known WMI GUID found!\n");
-		return -ENODEV;
-	}
-
-	if (!dmi_check_system(gigabyte_laptop_known_working_platforms)) {
-		pr_err("Laptop not supported\n");
-		return -ENODEV;
-	}
-
-	result = platform_driver_register(&platform_driver);
-	if (result) {
-		pr_warn("Unable to register platform driver\n");
-		return result;
-	}
-
-	gigabyte = kzalloc(sizeof(struct gigabyte_laptop_wmi), GFP_KERNEL);
-	if (!gigabyte) {
-		result = -ENOMEM;
-		goto fail_platform_driver;
-	}
+	gigabyte = gigabyte_laptop_alloc(model);
+	if (!gigabyte)
+		return -ENOMEM;
 
 	platform_device = platform_device_alloc(GIGABYTE_LAPTOP_FILE, -1);
 	if (!platform_device) {
 		pr_warn("Unable to allocate platform device\n");
-		kfree(gigabyte);
-		result = -ENOMEM;
-		goto fail_platform_driver;
+		gigabyte_laptop_free(gigabyte);
+		return -ENOMEM;
 	}
 
 	gigabyte->pdev = platform_device;
+	gigabyte_laptop_caps = model->caps;
 	platform_set_drvdata(gigabyte->pdev, gigabyte);
 
 	result = platform_device_add(gigabyte->pdev);
@@ -976,38 +3258,184 @@ static int __init gigabyte_laptop_init(void)
 		goto fail_platform_device;
 	}
 
+	// Feature probing may drop capabilities, so it runs before sysfs is set up.
+	result = gigabyte_laptop_probe(&gigabyte->pdev->dev);
+	if (result) {
+		pr_err("Probe failed\n");
+		goto fail_probe;
+	}
+
 	result = sysfs_create_group(&gigabyte->pdev->dev.kobj,
 					&gigabyte_laptop_attr_group);
 	if (result)
-		goto fail_sysfs;
-
-	gigabyte->hwmon_dev = hwmon_device_register_with_info(&gigabyte->pdev->dev,
-			GIGABYTE_LAPTOP_FILE, gigabyte, &gigabyte_laptop_chip_info, NULL);
-	if (IS_ERR(gigabyte->hwmon_dev)) {
-		result = PTR_ERR(gigabyte->hwmon_dev);
-		pr_err("hwmon registration failed with %d\n", result);
-		goto fail_sysfs;
-	}
+		goto fail_probe;
 
-	result = gigabyte_laptop_probe(&gigabyte->pdev->dev);
+	gigabyte_laptop_miscdev.parent = &gigabyte->pdev->dev;
+	result = misc_register(&gigabyte_laptop_miscdev);
 	if (result) {
-		pr_err("Probe failed\n");
-		goto fail_probe;
+		pr_err("Unable to register character device\n");
+		goto fail_misc;
 	}
-	pr_info("Hello, World!\n");
+
+	// Debugging aids only, so failing to create them is not fatal.
+	gigabyte->debugfs = debugfs_create_dir(GIGABYTE_LAPTOP_FILE, NULL);
+	debugfs_create_file("telemetry", 0400, gigabyte->debugfs, gigabyte,
+			&gigabyte_laptop_telemetry_fops);
+	debugfs_create_file("stats", 0600, gigabyte->debugfs, NULL,
+			&gigabyte_laptop_stats_fops);
+	debugfs_create_file("record", 0600, gigabyte->debugfs, NULL,
+			&gigabyte_laptop_record_fops);
+	debugfs_create_file("calls", 0400, gigabyte->debugfs, NULL,
+			&gigabyte_laptop_calls_fops);
+
+	schedule_work(&gigabyte->probe_work);
+	pr_info("Hello, World! Probe took %lld us\n",
+		ktime_us_delta(ktime_get(), start));
 	return 0;
 
-fail_probe:
-	hwmon_device_unregister(gigabyte->hwmon_dev);
+fail_misc:
 	sysfs_remove_group(&gigabyte->pdev->dev.kobj, &gigabyte_laptop_attr_group);
-fail_sysfs:
+	flush_work(&gigabyte->cmd_work);
+fail_probe:
 	platform_device_del(gigabyte->pdev);
 fail_platform_device:
 	platform_device_put(gigabyte->pdev);
-fail_platform_driver:
+	platform_device = NULL;
+	gigabyte_laptop_free(gigabyte);
+	return result;
+}
+
+/*
+ * WMBC and WMBD are exposed as two WMI devices. The driver is only set up
+ * once both of them are bound, and torn down as soon as either goes away.
+ * The event GUID is optional.
+ */
+static int gigabyte_laptop_wmi_probe(struct wmi_device *wdev, const void *context)
+{
+	enum gigabyte_laptop_guid guid = (uintptr_t)context;
+	int result = 0;
+
+	// The KUnit suite owns the transport, so keep real firmware out of it.
+	if (IS_ENABLED(AORUS_LAPTOP_KUNIT))
+		return -ENODEV;
+
+	mutex_lock(&gigabyte_laptop_bind_lock);
+	WRITE_ONCE(gigabyte_laptop_wdev[guid], wdev);
+	if (guid != GIGABYTE_LAPTOP_EVENT && gigabyte_laptop_wdev[GIGABYTE_LAPTOP_WMBC] &&
+			gigabyte_laptop_wdev[GIGABYTE_LAPTOP_WMBD]) {
+		result = gigabyte_laptop_setup();
+		if (result)
+			WRITE_ONCE(gigabyte_laptop_wdev[guid], NULL);
+	}
+	mutex_unlock(&gigabyte_laptop_bind_lock);
+	return result;
+}
+
+static void gigabyte_laptop_wmi_remove(struct wmi_device *wdev)
+{
+	mutex_lock(&gigabyte_laptop_bind_lock);
+	if (platform_device && wdev != gigabyte_laptop_wdev[GIGABYTE_LAPTOP_EVENT])
+		gigabyte_laptop_teardown();
+	for (int i = 0; i < GIGABYTE_LAPTOP_GUIDS; i++)
+		if (gigabyte_laptop_wdev[i] == wdev)
+			WRITE_ONCE(gigabyte_laptop_wdev[i], NULL);
+	mutex_unlock(&gigabyte_laptop_bind_lock);
+}
+
+/*
+ * Firmware sends Notify (AMW0, 0xD2) with the ID and new value of what
+ * changed (_WED returns DEVS). Hotkeys can change fan mode, charging and GPU
+ * boost behind the driver's back, so just refresh all of them.
+ */
+static void gigabyte_laptop_wmi_notify(struct wmi_device *wdev, union acpi_object *data)
+{
+	struct gigabyte_laptop_wmi *gigabyte;
+
+	if (data && data->type == ACPI_TYPE_BUFFER)
+		pr_debug("WMI event %*ph\n", data->buffer.length, data->buffer.pointer);
+
+	mutex_lock(&gigabyte_laptop_bind_lock);
+	if (platform_device) {
+		gigabyte = platform_get_drvdata(platform_device);
+		gigabyte_laptop_post_command(gigabyte, CMD_REFRESH, 0);
+	}
+	mutex_unlock(&gigabyte_laptop_bind_lock);
+}
+
+static const struct wmi_device_id gigabyte_laptop_wmi_id_table[] = {
+	{ .guid_string = WMI_METHOD_WMBC, .context = (void *)(uintptr_t)GIGABYTE_LAPTOP_WMBC },
+	{ .guid_string = WMI_METHOD_WMBD, .context = (void *)(uintptr_t)GIGABYTE_LAPTOP_WMBD },
+	{ .guid_string = WMI_EVENT, .context = (void *)(uintptr_t)GIGABYTE_LAPTOP_EVENT },
+	{ }
+};
+MODULE_DEVICE_TABLE(wmi, gigabyte_laptop_wmi_id_table);
+
+static struct wmi_driver gigabyte_laptop_wmi_driver = {
+	.driver = {
+		.name = GIGABYTE_LAPTOP_FILE,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+	},
+	.id_table = gigabyte_laptop_wmi_id_table,
+	.probe = gigabyte_laptop_wmi_probe,
+	.remove = gigabyte_laptop_wmi_remove,
+	.notify = gigabyte_laptop_wmi_notify,
+};
+
+static void __exit gigabyte_laptop_exit(void)
+{
+	wmi_driver_unregister(&gigabyte_laptop_wmi_driver);
+	platform_driver_unregister(&platform_driver);
+	genl_unregister_family(&gigabyte_laptop_genl_family);
+	free_percpu(gigabyte_laptop_stats);
+	kvfree(gigabyte_laptop_record);
+}
+
+static int __init gigabyte_laptop_init(void)
+{
+	int result;
+
+	gigabyte_laptop_dmi_id = dmi_first_match(gigabyte_laptop_known_working_platforms);
+	if (!gigabyte_laptop_dmi_id && !IS_ENABLED(AORUS_LAPTOP_KUNIT)) {
+		pr_err("Laptop not supported\n");
+		return -ENODEV;
+	}
+
+	gigabyte_laptop_stats = alloc_percpu(struct gigabyte_laptop_stats);
+	if (!gigabyte_laptop_stats)
+		return -ENOMEM;
+
+	result = genl_register_family(&gigabyte_laptop_genl_family);
+	if (result) {
+		pr_warn("Unable to register netlink family\n");
+		goto fail_genl;
+	}
+
+	result = platform_driver_register(&platform_driver);
+	if (result) {
+		pr_warn("Unable to register platform driver\n");
+		goto fail_platform_driver;
+	}
+
+	result = wmi_driver_register(&gigabyte_laptop_wmi_driver);
+	if (result) {
+		pr_warn("Unable to register WMI driver\n");
+		goto fail_wmi_driver;
+	}
+
+	return 0;
+
+fail_wmi_driver:
 	platform_driver_unregister(&platform_driver);
+fail_platform_driver:
+	genl_unregister_family(&gigabyte_laptop_genl_family);
+fail_genl:
+	free_percpu(gigabyte_laptop_stats);
 	return result;
 }
 
 module_init(gigabyte_laptop_init);
 module_exit(gigabyte_laptop_exit);
+
+#ifdef AORUS_LAPTOP_KUNIT
+#include "tests/aorus-laptop-kunit.c"
+#endif
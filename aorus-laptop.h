@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ *  aorus-laptop.h - Userspace interface of the AORUS laptop WMI driver
+ *
+ *  Copyright (C) 2023 Albert Tang
+ */
+
+#ifndef _AORUS_LAPTOP_H
+#define _AORUS_LAPTOP_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Operation types */
+#define AORUS_LAPTOP_OP_GET 0 // WMBC, returns the value of the method
+#define AORUS_LAPTOP_OP_SET 1 // Same values and limits as the matching sysfs node
+
+#define AORUS_LAPTOP_BATCH_MAX 64
+
+/*
+ * One operation of a batch. A get returns the value read in value, and error
+ * is set to a negative errno if the operation failed.
+ */
+struct aorus_laptop_op {
+	__u8 type;
+	__u8 method;
+	__u16 reserved; // Must be 0
+	__u32 arg;
+	__u32 value;
+	__s32 error;
+};
+
+struct aorus_laptop_batch {
+	__u32 count;
+	__u32 flags; // Must be 0
+	__u64 ops; // Pointer to an array of count struct aorus_laptop_op
+};
+
+/*
+ * Page that can be mapped read-only from /dev/aorus_laptop. seq is odd while
+ * the page is being updated: read it, copy the rest, and start over if it was
+ * odd or has changed since.
+ */
+struct aorus_laptop_status {
+	__u32 seq;
+	__u32 valid; // AORUS_LAPTOP_STATUS_TEMP(i) and AORUS_LAPTOP_STATUS_FAN(i)
+	__u64 timestamp; // CLOCK_MONOTONIC time of the sample, in nanoseconds
+	__s32 temp[4]; // Millidegrees Celsius, same order as the hwmon channels
+	__u32 fan[4]; // RPM
+	__s32 fan_mode;
+	__s32 fan_custom_speed;
+	__s32 charge_mode;
+	__s32 charge_limit;
+	__s32 gpu_boost;
+	__s32 fan_control;
+};
+
+#define AORUS_LAPTOP_STATUS_TEMP(i) (1 << (i))
+#define AORUS_LAPTOP_STATUS_FAN(i)  (1 << (8 + (i)))
+
+/*
+ * Record of the telemetry stream read from debugfs (aorus_laptop/telemetry).
+ * Records are numbered from 0, so a gap in seq means records were lost.
+ */
+struct aorus_laptop_record {
+	__u64 seq;
+	__u64 timestamp; // CLOCK_MONOTONIC time of the sample, in nanoseconds
+	__s32 temp[4]; // Millidegrees Celsius
+	__u16 fan[4]; // RPM
+	__u16 valid; // AORUS_LAPTOP_STATUS_TEMP(i) and AORUS_LAPTOP_STATUS_FAN(i)
+	__u8 fan_mode;
+	__u8 fan_custom_speed;
+	__u32 reserved;
+};
+
+/*
+ * Generic netlink family. Every sensor sample and every change of state is
+ * sent once to the multicast group, whatever the number of subscribers.
+ */
+#define AORUS_LAPTOP_GENL_NAME    "aorus_laptop"
+#define AORUS_LAPTOP_GENL_VERSION 1
+#define AORUS_LAPTOP_GENL_MCGRP   "events"
+
+enum {
+	AORUS_LAPTOP_CMD_UNSPEC,
+	AORUS_LAPTOP_CMD_SAMPLE, // Sensor sample
+	AORUS_LAPTOP_CMD_STATE, // Fan mode, charging or GPU boost changed
+	__AORUS_LAPTOP_CMD_MAX,
+};
+#define AORUS_LAPTOP_CMD_MAX (__AORUS_LAPTOP_CMD_MAX - 1)
+
+enum {
+	AORUS_LAPTOP_ATTR_UNSPEC,
+	AORUS_LAPTOP_ATTR_PAD,
+	AORUS_LAPTOP_ATTR_TIMESTAMP, // u64, CLOCK_MONOTONIC nanoseconds
+	AORUS_LAPTOP_ATTR_TEMP, // Nested s32 millidegrees, by channel number
+	AORUS_LAPTOP_ATTR_FAN, // Nested u32 RPM, by channel number
+	AORUS_LAPTOP_ATTR_FAN_MODE, // u32, as the sysfs node
+	AORUS_LAPTOP_ATTR_FAN_CUSTOM_SPEED, // u32
+	AORUS_LAPTOP_ATTR_CHARGE_MODE, // u32
+	AORUS_LAPTOP_ATTR_CHARGE_LIMIT, // u32
+	AORUS_LAPTOP_ATTR_GPU_BOOST, // u32
+	__AORUS_LAPTOP_ATTR_MAX,
+};
+#define AORUS_LAPTOP_ATTR_MAX (__AORUS_LAPTOP_ATTR_MAX - 1)
+
+/*
+ * Firmware call, as recorded in debugfs (aorus_laptop/calls) and read back
+ * by tests/emu-replay.
+ */
+#define AORUS_LAPTOP_CALL_WMBC       0
+#define AORUS_LAPTOP_CALL_WMBD       1
+#define AORUS_LAPTOP_CALL_EC_READ    2
+#define AORUS_LAPTOP_CALL_EC_WRITE   3
+
+struct aorus_laptop_call {
+	__u8 type;
+	__u8 method; // WMI method ID or EC register
+	__u8 result; // ACPI object type returned by a WMI method, 0 if none
+	__u8 length; // Length of a buffer result
+	__u32 arg; // WMI argument, or the byte written to the EC
+	__u32 status; // ACPI status of a WMI call, negative errno of an EC access
+	__u32 duration; // Nanoseconds
+	__u64 value; // Integer result, first 8 bytes of a buffer, or the byte read
+};
+
+/*
+ * Run every operation of a batch in order, and write the results back into
+ * the array. Failing operations don't stop the batch.
+ */
+#define AORUS_LAPTOP_IOC_BATCH _IOW('G', 0x01, struct aorus_laptop_batch)
+
+#endif
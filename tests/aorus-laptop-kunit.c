@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  aorus-laptop-kunit.c - KUnit tests of the AORUS laptop WMI driver
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Included at the end of aorus-laptop.c when built with AORUS_LAPTOP_KUNIT,
+ *  so the driver's own probe, sysfs stores and hwmon callbacks are tested.
+ *  They reach the emulated firmware of tests/emu.c through a transport
+ *  standing in for ACPI and the EC. The benchmarks count the calls each
+ *  operation makes to the firmware and fail when one needs more.
+ */
+
+#include <kunit/test.h>
+
+#include "emu.c"
+
+static struct {
+	struct aorus_emu emu;
+	u32 missing_method; // Returns nothing, like a method the DSDT lacks
+	struct gigabyte_laptop_wmi *gigabyte;
+	const struct gigabyte_laptop_transport *transport;
+	unsigned long caps;
+	u8 fan_silent_method;
+	bool blocking_writes;
+} gigabyte_laptop_test;
+
+/* Transport **********************************************/
+
+static acpi_status gigabyte_laptop_test_evaluate(enum gigabyte_laptop_guid guid, u32 method_id,
+				const struct acpi_buffer *in, struct acpi_buffer *out)
+{
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	union acpi_object *obj = out->pointer;
+	u32 arg = *(u32 *)in->pointer;
+	int ret, result;
+
+	switch (guid) {
+		case GIGABYTE_LAPTOP_WMBC:
+			ret = aorus_emu_wmbc(emu, method_id, arg, &result);
+			break;
+		case GIGABYTE_LAPTOP_WMBD:
+			ret = aorus_emu_wmbd(emu, method_id, arg, &result);
+			break;
+		default:
+			return AE_NOT_EXIST;
+	}
+
+	if (ret == -ENODATA || method_id == gigabyte_laptop_test.missing_method) {
+		out->length = 0;
+		return AE_OK;
+	}
+	if (ret)
+		return AE_ERROR;
+
+	obj->type = ACPI_TYPE_INTEGER;
+	obj->integer.value = (u32)result;
+	out->length = sizeof(*obj);
+	return AE_OK;
+}
+
+static int gigabyte_laptop_test_ec_read(u8 reg, u8 *val)
+{
+	return aorus_emu_ec_read(&gigabyte_laptop_test.emu, reg, val);
+}
+
+static int gigabyte_laptop_test_ec_write(u8 reg, u8 val)
+{
+	return aorus_emu_ec_write(&gigabyte_laptop_test.emu, reg, val);
+}
+
+static const struct gigabyte_laptop_transport gigabyte_laptop_test_transport = {
+	.evaluate = gigabyte_laptop_test_evaluate,
+	.ec_read = gigabyte_laptop_test_ec_read,
+	.ec_write = gigabyte_laptop_test_ec_write,
+};
+
+static u32 emu_wmi_calls(const struct aorus_emu *emu)
+{
+	return emu->stats.wmbc + emu->stats.wmbd;
+}
+
+static u32 emu_ec_calls(const struct aorus_emu *emu)
+{
+	return emu->stats.ec_read + emu->stats.ec_write;
+}
+
+/*
+ * Every test gets a fresh driver instance on an Aero 15 Classic, with the
+ * platform device registered but neither sysfs nor hwmon, so nothing but
+ * the test reaches the driver.
+ */
+static int gigabyte_laptop_test_init(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte;
+	struct platform_device *pdev;
+
+	gigabyte_laptop_test.transport = gigabyte_laptop_transport;
+	gigabyte_laptop_test.caps = gigabyte_laptop_caps;
+	gigabyte_laptop_test.fan_silent_method = fan_modes[1];
+	gigabyte_laptop_test.blocking_writes = blocking_writes;
+	gigabyte_laptop_test.missing_method = 0;
+	aorus_emu_init(&gigabyte_laptop_test.emu);
+	gigabyte_laptop_transport = &gigabyte_laptop_test_transport;
+	gigabyte_laptop_caps = aero_model.caps;
+	blocking_writes = true;
+
+	gigabyte = gigabyte_laptop_alloc(&aero_model);
+	if (!gigabyte)
+		return -ENOMEM;
+
+	pdev = platform_device_register_simple("aorus_laptop_test", PLATFORM_DEVID_AUTO, NULL, 0);
+	if (IS_ERR(pdev)) {
+		gigabyte_laptop_free(gigabyte);
+		return PTR_ERR(pdev);
+	}
+
+	gigabyte->pdev = pdev;
+	platform_set_drvdata(pdev, gigabyte);
+	gigabyte_laptop_test.gigabyte = gigabyte;
+	return 0;
+}
+
+static void gigabyte_laptop_test_exit(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+
+	cancel_delayed_work_sync(&gigabyte->sensor_work);
+	flush_work(&gigabyte->cmd_work);
+	platform_device_unregister(gigabyte->pdev);
+	gigabyte_laptop_free(gigabyte);
+
+	gigabyte_laptop_transport = gigabyte_laptop_test.transport;
+	gigabyte_laptop_caps = gigabyte_laptop_test.caps;
+	fan_modes[1] = gigabyte_laptop_test.fan_silent_method;
+	blocking_writes = gigabyte_laptop_test.blocking_writes;
+}
+
+/* Tests **************************************************/
+
+static void probe_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	struct device *dev = &gigabyte->pdev->dev;
+
+	aorus_emu_set_fan_mode(emu, 2);
+	emu->ec[EMU_FAN1] = fan_speed_to_duty(70);
+	emu->ec[EMU_BCPS] = 0x04;
+	emu->ec[EMU_BCPC] = 80;
+
+	KUNIT_ASSERT_EQ(test, gigabyte_laptop_probe(dev), 0);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_silent_method, FAN_SILENT_MODE);
+	KUNIT_EXPECT_EQ(test, fan_modes[1], FAN_SILENT_MODE);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_mode, 2);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_custom_display_speed, 70);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_custom_internal_speed, fan_speed_to_duty(70));
+	KUNIT_EXPECT_EQ(test, gigabyte->charge_mode, 1);
+	KUNIT_EXPECT_EQ(test, gigabyte->charge_limit, 80);
+	KUNIT_EXPECT_TRUE(test, gigabyte_laptop_caps & GIGABYTE_LAPTOP_CAP_CHARGE);
+
+	// Older firmware, without charging control.
+	aorus_emu_init(emu);
+	emu->old_silent = true;
+	gigabyte_laptop_test.missing_method = CHARGING_MODE;
+	KUNIT_ASSERT_EQ(test, gigabyte_laptop_probe(dev), 0);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_silent_method, FAN_SILENT_OLD);
+	KUNIT_EXPECT_EQ(test, fan_modes[1], FAN_SILENT_OLD);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_mode, 0);
+	KUNIT_EXPECT_FALSE(test, gigabyte_laptop_caps & GIGABYTE_LAPTOP_CAP_CHARGE);
+}
+
+static void fan_mode_transitions_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	int ret;
+
+	gigabyte->fan_custom_internal_speed = fan_speed_to_duty(90);
+	for (int from = 0; from < ARRAY_SIZE(fan_modes); from++) {
+		for (int to = 0; to < ARRAY_SIZE(fan_modes); to++) {
+			aorus_emu_init(emu);
+			aorus_emu_set_fan_mode(emu, from);
+			gigabyte->fan_mode = from;
+
+			mutex_lock(&gigabyte->state_lock);
+			ret = gigabyte_laptop_apply_fan_mode(gigabyte, to, _THIS_IP_);
+			mutex_unlock(&gigabyte->state_lock);
+
+			KUNIT_ASSERT_EQ_MSG(test, ret, 0, "from %d to %d", from, to);
+			KUNIT_EXPECT_EQ_MSG(test, aorus_emu_fan_mode(emu), to, "from %d to %d", from, to);
+			KUNIT_EXPECT_EQ(test, gigabyte->fan_mode, to);
+			KUNIT_EXPECT_LE(test, emu->stats.wmbd, FAN_MODE_OPS);
+		}
+	}
+}
+
+static void fan_custom_speed_store_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	struct device *dev = &gigabyte->pdev->dev;
+
+	KUNIT_EXPECT_EQ(test, fan_custom_speed_store(dev, NULL, "60", 2), 2);
+	KUNIT_EXPECT_EQ(test, emu->ec[EMU_FAN1], fan_speed_to_duty(60));
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_custom_display_speed, 60);
+
+	// Newer firmware leaves FAN2 to the driver.
+	emu->dual_fan = true;
+	gigabyte->dual_fan_speed_enabled = 1;
+	KUNIT_EXPECT_EQ(test, fan_custom_speed_store(dev, NULL, "85", 2), 2);
+	KUNIT_EXPECT_EQ(test, emu->ec[EMU_FAN1], fan_speed_to_duty(85));
+	KUNIT_EXPECT_EQ(test, emu->ec[EMU_FAN2], fan_speed_to_duty(85));
+
+	KUNIT_EXPECT_EQ(test, fan_custom_speed_store(dev, NULL, "62", 2), -EINVAL);
+	KUNIT_EXPECT_EQ(test, fan_custom_speed_store(dev, NULL, "20", 2), -EINVAL);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_custom_display_speed, 85);
+}
+
+static void fan_curve_data_store_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	struct device *dev = &gigabyte->pdev->dev;
+
+	for (int i = 0; i < FAN_CURVE_POINTS; i++) {
+		gigabyte->fan_curve.temperature[i] = emu->curve_temperature[i];
+		gigabyte->fan_curve.speed[i] = emu->curve_speed[i];
+	}
+	gigabyte->fan_curve_index = 7;
+
+	// The high byte is the speed and the low byte the temperature.
+	KUNIT_EXPECT_EQ(test, fan_curve_data_store(dev, NULL, "0xA046", 6), 6);
+	KUNIT_EXPECT_EQ(test, emu->curve_temperature[7], 0x46);
+	KUNIT_EXPECT_EQ(test, emu->curve_speed[7], 0xA0);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_curve.temperature[7], 0x46);
+	KUNIT_EXPECT_EQ(test, gigabyte->fan_curve.speed[7], 0xA0);
+
+	// Only the changed point is sent.
+	KUNIT_EXPECT_EQ(test, emu->stats.wmbd, 1);
+	KUNIT_EXPECT_EQ(test, emu->curve_temperature[6], 40 + 4 * 6);
+
+	KUNIT_EXPECT_EQ(test, fan_curve_data_store(dev, NULL, "0x10000", 7), -ERANGE);
+	KUNIT_EXPECT_EQ(test, emu->stats.wmbd, 1);
+}
+
+static void fan_curve_store_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	struct device *dev = &gigabyte->pdev->dev;
+	char buf[256];
+	int len = 0;
+
+	for (int i = 0; i < FAN_CURVE_POINTS; i++) {
+		gigabyte->fan_curve.temperature[i] = emu->curve_temperature[i];
+		gigabyte->fan_curve.speed[i] = emu->curve_speed[i];
+		len += scnprintf(buf + len, sizeof(buf) - len, "%d %d\n", 30 + 4 * i, 40 + 10 * i);
+	}
+
+	KUNIT_EXPECT_EQ(test, fan_curve_store(dev, NULL, buf, len), len);
+	KUNIT_EXPECT_EQ(test, emu->curve_temperature[14], 30 + 4 * 14);
+	KUNIT_EXPECT_EQ(test, emu->curve_speed[14], 40 + 10 * 14);
+
+	// A point past the last one is refused, and nothing is sent.
+	len = 0;
+	for (int i = 0; i <= FAN_CURVE_POINTS; i++)
+		len += scnprintf(buf + len, sizeof(buf) - len, "%d %d\n", 31 + 4 * i, 40 + 10 * i);
+	KUNIT_EXPECT_EQ(test, fan_curve_store(dev, NULL, buf, len), -EINVAL);
+	KUNIT_EXPECT_EQ(test, emu->curve_temperature[0], 30);
+}
+
+static void hwmon_read_test(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	struct device *dev = &gigabyte->pdev->dev;
+	long val;
+
+	// Nothing has been sampled yet.
+	KUNIT_EXPECT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_temp, hwmon_temp_input, 0, &val),
+		-ENODATA);
+
+	emu->cpu_power = 45000;
+	aorus_emu_set_fan_mode(emu, 2);
+	aorus_emu_advance(emu, 5000);
+
+	// The EC map of the model, then the default one that goes through WMI.
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass)
+			gigabyte->ec_map = default_ec_map;
+		gigabyte->temp_present = 0;
+		gigabyte->fan_present = 0;
+		gigabyte_laptop_discover_sensors(gigabyte);
+		gigabyte_laptop_sample_sensors(gigabyte);
+
+		// Single GPU.
+		KUNIT_EXPECT_EQ(test, gigabyte->temp_present, 0x07);
+		KUNIT_EXPECT_EQ(test, gigabyte->fan_present, 0x03);
+
+		KUNIT_ASSERT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_temp, hwmon_temp_input,
+			0, &val), 0);
+		KUNIT_EXPECT_EQ(test, val, emu->ec[EMU_TCPU] * 1000);
+		KUNIT_ASSERT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_temp, hwmon_temp_input,
+			1, &val), 0);
+		KUNIT_EXPECT_EQ(test, val, emu->ec[EMU_TGP1] * 1000);
+		KUNIT_ASSERT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_temp, hwmon_temp_input,
+			2, &val), 0);
+		KUNIT_EXPECT_EQ(test, val, emu->ec[EMU_FTP1] * 1000);
+		for (int i = 0; i < 2; i++) {
+			KUNIT_ASSERT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_fan, hwmon_fan_input,
+				i, &val), 0);
+			KUNIT_EXPECT_EQ(test, val, emu->rpm[i]);
+		}
+	}
+
+	KUNIT_ASSERT_EQ(test, gigabyte_laptop_hwmon_read(dev, hwmon_chip,
+		hwmon_chip_update_interval, 0, &val), 0);
+	KUNIT_EXPECT_EQ(test, val, clamp_val(update_interval, 100, 60000));
+}
+
+/* Benchmarks *********************************************/
+
+static void bench_sensor_sample(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+
+	gigabyte->temp_present = 0x07;
+	gigabyte->fan_present = 0x03;
+	gigabyte_laptop_sample_sensors(gigabyte);
+
+	kunit_info(test, "sensor sample: %u WMI calls, %u EC calls, %llu us in firmware\n",
+		emu_wmi_calls(emu), emu_ec_calls(emu), emu->stats.busy_us);
+
+	// 3 temperatures and 2 RPMs of 2 bytes, all from the EC.
+	KUNIT_EXPECT_EQ(test, emu_wmi_calls(emu), 0);
+	KUNIT_EXPECT_EQ(test, emu_ec_calls(emu), 3 + 2 * 2);
+}
+
+static void bench_fan_mode_switch(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+	u32 calls, worst = 0;
+
+	gigabyte->fan_custom_internal_speed = 0x80;
+	for (int from = 0; from < ARRAY_SIZE(fan_modes); from++) {
+		for (int to = 0; to < ARRAY_SIZE(fan_modes); to++) {
+			aorus_emu_init(emu);
+			aorus_emu_set_fan_mode(emu, from);
+			gigabyte->fan_mode = from;
+			mutex_lock(&gigabyte->state_lock);
+			gigabyte_laptop_apply_fan_mode(gigabyte, to, _THIS_IP_);
+			mutex_unlock(&gigabyte->state_lock);
+			calls = emu_wmi_calls(emu) + emu_ec_calls(emu);
+			worst = max(worst, calls);
+		}
+	}
+
+	kunit_info(test, "fan mode switch: at most %u calls\n", worst);
+	KUNIT_EXPECT_LE(test, worst, FAN_MODE_OPS);
+}
+
+static void bench_probe(struct kunit *test)
+{
+	struct gigabyte_laptop_wmi *gigabyte = gigabyte_laptop_test.gigabyte;
+	struct aorus_emu *emu = &gigabyte_laptop_test.emu;
+
+	KUNIT_ASSERT_EQ(test, gigabyte_laptop_probe(&gigabyte->pdev->dev), 0);
+
+	kunit_info(test, "probe: %u WMI calls, %u EC calls, %llu us in firmware\n",
+		emu_wmi_calls(emu), emu_ec_calls(emu), emu->stats.busy_us);
+	KUNIT_EXPECT_LE(test, emu_wmi_calls(emu), 7);
+	KUNIT_EXPECT_EQ(test, emu_ec_calls(emu), 0);
+}
+
+static struct kunit_case gigabyte_laptop_test_cases[] = {
+	KUNIT_CASE(probe_test),
+	KUNIT_CASE(fan_mode_transitions_test),
+	KUNIT_CASE(fan_custom_speed_store_test),
+	KUNIT_CASE(fan_curve_data_store_test),
+	KUNIT_CASE(fan_curve_store_test),
+	KUNIT_CASE(hwmon_read_test),
+	KUNIT_CASE(bench_sensor_sample),
+	KUNIT_CASE(bench_fan_mode_switch),
+	KUNIT_CASE(bench_probe),
+	{}
+};
+
+static struct kunit_suite gigabyte_laptop_test_suite = {
+	.name = "aorus-laptop",
+	.init = gigabyte_laptop_test_init,
+	.exit = gigabyte_laptop_test_exit,
+	.test_cases = gigabyte_laptop_test_cases,
+};
+kunit_test_suite(gigabyte_laptop_test_suite);
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  emu-replay.c - Replays a recording of the driver's firmware calls
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Usage: emu-replay CALLS, with CALLS read from aorus_laptop/calls in
+ *  debugfs. Makes every recorded call to the emulator, to show where the
+ *  laptop's firmware differs from it, then runs the driver's sequences
+ *  against the recording to show how many calls they take on that laptop,
+ *  and how long the firmware took to answer them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "replay.h"
+
+// Every method of every call type.
+#define REPLAY_METHODS (4 * 256)
+
+static const char * const call_types[] = {
+	[AORUS_LAPTOP_CALL_WMBC] = "WMBC",
+	[AORUS_LAPTOP_CALL_WMBD] = "WMBD",
+	[AORUS_LAPTOP_CALL_EC_READ] = "EC read",
+	[AORUS_LAPTOP_CALL_EC_WRITE] = "EC write",
+};
+
+// Recordings are copied out of debugfs first, so they can be sized with fseek().
+static struct aorus_laptop_call *read_calls(const char *path, u32 *count)
+{
+	struct aorus_laptop_call *calls = NULL;
+	FILE *file;
+	long size;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return NULL;
+	}
+
+	if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET)) {
+		perror(path);
+	} else if (!size || size % sizeof(*calls)) {
+		fprintf(stderr, "%s: not a recording of calls\n", path);
+	} else {
+		calls = malloc(size);
+		if (calls && fread(calls, size, 1, file) != 1) {
+			fprintf(stderr, "%s: read error\n", path);
+			free(calls);
+			calls = NULL;
+		}
+		*count = size / sizeof(*calls);
+	}
+	fclose(file);
+	return calls;
+}
+
+static void print_methods(const struct aorus_laptop_call *calls, u32 count)
+{
+	static struct emu_replay_method methods[REPLAY_METHODS];
+	struct aorus_emu emu;
+	int used;
+
+	aorus_emu_init(&emu);
+	used = emu_replay_compare(&emu, calls, count, methods, REPLAY_METHODS);
+	if (used < 0) {
+		fprintf(stderr, "Too many different methods\n");
+		return;
+	}
+
+	printf("%-10s %6s %6s %10s %12s %12s\n", "Call", "Method", "Calls", "Mismatches",
+		"Recorded us", "Emulated us");
+	for (int i = 0; i < used; i++) {
+		printf("%-10s   0x%02x %6u %10u %12llu %12llu\n",
+			methods[i].type < ARRAY_SIZE(call_types) ? call_types[methods[i].type] : "?",
+			methods[i].method, methods[i].calls, methods[i].mismatches,
+			(unsigned long long)(methods[i].recorded_ns / 1000 / methods[i].calls),
+			(unsigned long long)(methods[i].modeled_us / methods[i].calls));
+	}
+}
+
+static void print_sequences(const struct aorus_laptop_call *calls, u32 count)
+{
+	struct emu_replay replay;
+
+	printf("\n%-28s %6s %8s %12s\n", "Sequence", "Calls", "Missing", "Recorded us");
+	for (int i = 0; i < EMU_SEQUENCES; i++) {
+		replay = (struct emu_replay){ .calls = calls, .count = count };
+		emu_sequences[i].run(&emu_replay_fw_ops, &replay);
+		printf("%-28s %6u %8u %12llu\n", emu_sequences[i].name, replay.answered,
+			replay.missing, (unsigned long long)(replay.duration_ns / 1000));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct aorus_laptop_call *calls;
+	u32 count;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s CALLS\n", argv[0]);
+		return 2;
+	}
+
+	calls = read_calls(argv[1], &count);
+	if (!calls)
+		return 1;
+
+	printf("%u calls recorded\n\n", count);
+	print_methods(calls, count);
+	print_sequences(calls, count);
+	free(calls);
+	return 0;
+}
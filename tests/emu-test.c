@@ -0,0 +1,562 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  emu-test.c - Tests of the driver's firmware logic against the emulator
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Run with make emu-test. Prints TAP, and exits with 1 if anything failed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+
+static int failed;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		printf("#   %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failed = 1; \
+	} \
+} while (0)
+
+/* Helpers ************************************************/
+
+struct emu_cost {
+	u32 wmi;
+	u32 ec;
+	u64 us;
+};
+
+static void cost_begin(const struct aorus_emu *emu, struct emu_cost *cost)
+{
+	cost->wmi = emu->stats.wmbc + emu->stats.wmbd;
+	cost->ec = emu->stats.ec_read + emu->stats.ec_write;
+	cost->us = emu->stats.busy_us;
+}
+
+static void cost_end(const struct aorus_emu *emu, struct emu_cost *cost)
+{
+	cost->wmi = emu->stats.wmbc + emu->stats.wmbd - cost->wmi;
+	cost->ec = emu->stats.ec_read + emu->stats.ec_write - cost->ec;
+	cost->us = emu->stats.busy_us - cost->us;
+}
+
+static void cost_print(const char *operation, const struct emu_cost *cost)
+{
+	printf("# %-32s %3u WMI calls %3u EC calls %8llu us\n", operation, cost->wmi, cost->ec,
+		(unsigned long long)cost->us);
+}
+
+/* Speed tables *******************************************/
+
+static void test_speed_tables(void)
+{
+	for (int speed = 0; speed <= 105; speed++) {
+		CHECK(fan_speed_valid(speed) ==
+			(speed >= FAN_SPEED_MIN && speed <= 100 && speed % FAN_SPEED_STEP == 0));
+		if (!fan_speed_valid(speed))
+			continue;
+
+		CHECK(fan_speed_to_duty(speed) == speed * FAN_DUTY_MAX / 100);
+		CHECK(fan_duty_to_speed(fan_speed_to_duty(speed)) == speed);
+	}
+
+	CHECK(fan_speed_to_duty(100) == FAN_DUTY_MAX);
+	CHECK(fan_duty_to_speed(0x5D) == 40);
+	CHECK(fan_duty_to_speed(0) == 40);
+}
+
+static void test_convert_fan_rpm(void)
+{
+	struct aorus_emu emu;
+	int output;
+	u8 rpm[2];
+
+	aorus_emu_init(&emu);
+	emu.cpu_power = 45000;
+	aorus_emu_set_fan_mode(&emu, 2);
+	aorus_emu_advance(&emu, 5000);
+	CHECK(emu.rpm[0] > 255);
+
+	// WMBC returns the field as stored, the EC holds it big-endian.
+	CHECK(!aorus_emu_wmbc(&emu, FAN_CPU_RPM, 0, &output));
+	CHECK(!aorus_emu_fw_ops.ec_read(&emu, EMU_RPM1, NULL, rpm, 2));
+	CHECK(convert_fan_rpm(output) == emu.rpm[0]);
+	CHECK(convert_fan_rpm(output) == (rpm[0] << 8 | rpm[1]));
+}
+
+/* Probe **************************************************/
+
+static void test_probe_silent_method(void)
+{
+	struct aorus_emu emu;
+
+	aorus_emu_init(&emu);
+	CHECK(gigabyte_laptop_probe_silent_method(&aorus_emu_fw_ops, &emu) == FAN_SILENT_MODE);
+
+	aorus_emu_init(&emu);
+	emu.old_silent = true;
+	CHECK(gigabyte_laptop_probe_silent_method(&aorus_emu_fw_ops, &emu) == FAN_SILENT_OLD);
+}
+
+static void test_probe_dual_fan(void)
+{
+	struct aorus_emu emu;
+	u8 speed = fan_speed_to_duty(60);
+
+	aorus_emu_init(&emu);
+	CHECK(!gigabyte_laptop_probe_dual_fan(&aorus_emu_fw_ops, &emu, speed));
+	CHECK(emu.ec[EMU_FAN1] == speed && emu.ec[EMU_FAN2] == speed);
+
+	aorus_emu_init(&emu);
+	emu.dual_fan = true;
+	CHECK(gigabyte_laptop_probe_dual_fan(&aorus_emu_fw_ops, &emu, speed));
+	CHECK(emu.ec[EMU_FAN1] == speed);
+}
+
+// Firmware without charging control, where CHARGING_MODE returns nothing.
+static int no_charge_wmbc(void *data, u8 method, u32 arg, int *result)
+{
+	if (method == CHARGING_MODE)
+		return -ENODATA;
+	return aorus_emu_fw_ops.wmbc(data, method, arg, result);
+}
+
+static void test_probe_state(void)
+{
+	struct gigabyte_laptop_fw_ops no_charge = aorus_emu_fw_ops;
+	struct gigabyte_laptop_probe_state state = { .charge = true };
+	struct emu_cost cost;
+	struct aorus_emu emu;
+
+	aorus_emu_init(&emu);
+	aorus_emu_set_fan_mode(&emu, 2);
+	emu.ec[EMU_FAN1] = fan_speed_to_duty(70);
+	emu.ec[EMU_BCPS] = 0x04;
+	emu.ec[EMU_BCPC] = 80;
+	cost_begin(&emu, &cost);
+	CHECK(!gigabyte_laptop_probe_state(&aorus_emu_fw_ops, &emu, &state));
+	cost_end(&emu, &cost);
+	CHECK(state.silent_method == FAN_SILENT_MODE);
+	CHECK(state.fan_mode == 2);
+	CHECK(state.custom_speed == fan_speed_to_duty(70));
+	CHECK(state.charge && state.charge_mode == 1 && state.charge_limit == 80);
+	// Silent method, 2 fan mode checks, custom speed and 2 charging reads.
+	CHECK(cost.wmi == 6 && cost.ec == 0);
+
+	// Custom mode takes the EC read and the fixed mode check as well.
+	aorus_emu_init(&emu);
+	emu.old_silent = true;
+	aorus_emu_set_fan_mode(&emu, 5);
+	state = (struct gigabyte_laptop_probe_state){ .charge = false };
+	CHECK(!gigabyte_laptop_probe_state(&aorus_emu_fw_ops, &emu, &state));
+	CHECK(state.silent_method == FAN_SILENT_OLD);
+	CHECK(state.fan_mode == 5);
+	CHECK(state.custom_speed == fan_speed_to_duty(35));
+	CHECK(!state.charge && !state.charge_limit);
+
+	no_charge.wmbc = no_charge_wmbc;
+	aorus_emu_init(&emu);
+	state = (struct gigabyte_laptop_probe_state){ .charge = true };
+	CHECK(!gigabyte_laptop_probe_state(&no_charge, &emu, &state));
+	CHECK(state.fan_mode == 0);
+	CHECK(!state.charge && !state.charge_limit);
+}
+
+/* Sensors ************************************************/
+
+// Both ways of reading a sensor agree, and a failed channel keeps its value.
+static void test_read_sensors(void)
+{
+	static const struct gigabyte_laptop_ec_map no_map;
+	struct gigabyte_laptop_sensors wmi = { 0 }, ec = { 0 };
+	struct aorus_emu emu;
+	long val = 0;
+
+	aorus_emu_init(&emu);
+	emu.cpu_power = 45000;
+	aorus_emu_set_fan_mode(&emu, 2);
+	aorus_emu_advance(&emu, 5000);
+
+	gigabyte_laptop_read_sensors(&aorus_emu_fw_ops, &emu, &aorus_emu_wmi_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &wmi);
+	gigabyte_laptop_read_sensors(&aorus_emu_fw_ops, &emu, &aorus_emu_ec_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &ec);
+	for (int i = 0; i < TEMP_CHANNELS; i++) {
+		CHECK(!wmi.temp_ret[i] && !ec.temp_ret[i]);
+		CHECK(wmi.temp[i] == ec.temp[i]);
+	}
+	for (int i = 0; i < 2; i++) {
+		CHECK(!wmi.fan_ret[i] && !ec.fan_ret[i]);
+		CHECK(wmi.fan[i] == ec.fan[i] && ec.fan[i] == emu.rpm[i]);
+	}
+	CHECK(ec.temp[0] == emu.cpu_temp / 1000 * 1000);
+
+	// Only the present channels are read.
+	CHECK(!wmi.fan_ret[2] && !wmi.fan[2]);
+
+	CHECK(!gigabyte_laptop_read_temp_channel(&aorus_emu_fw_ops, &emu, &aorus_emu_ec_map, 0, &val));
+	CHECK(val == ec.temp[0]);
+
+	// The motherboard has no WMBC method.
+	CHECK(gigabyte_laptop_read_temp_channel(&aorus_emu_fw_ops, &emu, &no_map, 2, &val) ==
+		-ENODATA);
+	CHECK(!gigabyte_laptop_read_fan_channel(&aorus_emu_fw_ops, &emu, &aorus_emu_wmi_map, 1, &val));
+	CHECK(val == emu.rpm[1]);
+}
+
+/* Fan curve **********************************************/
+
+static void test_fan_curve(void)
+{
+	struct aorus_emu emu;
+	struct emu_cost cost;
+	int output;
+
+	aorus_emu_init(&emu);
+	for (u8 i = 0; i < FAN_CURVE_POINTS; i++)
+		CHECK(!aorus_emu_wmbd(&emu, FAN_INDEX_VALUE,
+			fan_curve_payload(i, 30 + 5 * i, 100 - 5 * i), &output));
+
+	cost_begin(&emu, &cost);
+	for (u8 i = 0; i < FAN_CURVE_POINTS; i++) {
+		CHECK(!aorus_emu_wmbc(&emu, FAN_INDEX_VALUE, i, &output));
+		CHECK((output & 0xFF) == 30 + 5 * i);
+		CHECK(output >> 8 == 100 - 5 * i);
+	}
+	cost_end(&emu, &cost);
+
+	// Each point read sleeps for 100 ms in AML, which is why the driver caches them.
+	CHECK(cost.us >= FAN_CURVE_POINTS * 100000);
+	cost_print("Read the fan curve", &cost);
+}
+
+// The sysfs and WMBC encoding of a point, against what WMBD stores.
+static void test_fan_curve_point(void)
+{
+	struct aorus_emu emu;
+	u8 temperature, speed;
+	int output;
+
+	CHECK(fan_curve_payload(3, 0x46, 0xA0) == 0xA04603);
+	CHECK(fan_curve_point(0x46, 0xA0) == 0xA046);
+	fan_curve_point_unpack(0xA046, &temperature, &speed);
+	CHECK(temperature == 0x46 && speed == 0xA0);
+
+	aorus_emu_init(&emu);
+	CHECK(!aorus_emu_wmbd(&emu, FAN_INDEX_VALUE, fan_curve_payload(7, 61, 200), &output));
+	CHECK(emu.curve_temperature[7] == 61 && emu.curve_speed[7] == 200);
+	CHECK(!aorus_emu_wmbc(&emu, FAN_INDEX_VALUE, 7, &output));
+	CHECK(output == fan_curve_point(61, 200));
+}
+
+/* Fan modes **********************************************/
+
+static void test_fan_mode_switch(void)
+{
+	struct aorus_emu emu;
+	u8 speed = fan_speed_to_duty(80);
+
+	aorus_emu_init(&emu);
+	CHECK(!gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, 0, 4, speed));
+	CHECK(aorus_emu_fan_mode(&emu) == 4);
+	CHECK(emu.ec[EMU_FAN1] == speed && emu.ec[EMU_FAN2] == speed);
+
+	CHECK(!gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, 4, 0, speed));
+	CHECK(aorus_emu_fan_mode(&emu) == 0);
+}
+
+// Whether the EC holds exactly the bits the driver leaves for a mode.
+static bool emu_in_mode(const struct aorus_emu *emu, int mode)
+{
+	return aorus_emu_bit(emu, EMU_CRAF) == (mode == 1) &&
+		aorus_emu_bit(emu, EMU_FANB) == (mode == 2) &&
+		aorus_emu_bit(emu, EMU_TENF) == (mode >= 3) &&
+		aorus_emu_bit(emu, EMU_GFAN) == (mode == 4) &&
+		aorus_emu_bit(emu, EMU_ADJF) == (mode == 5);
+}
+
+// Fewest WMBD calls that take the EC from one mode to another, by search.
+static int shortest_switch(const struct aorus_emu *start, int to, u8 speed, int depth)
+{
+	struct aorus_emu emu;
+	int best = -1, found, output;
+
+	if (emu_in_mode(start, to))
+		return 0;
+	if (!depth)
+		return -1;
+
+	for (int mode = 1; mode < ARRAY_SIZE(fan_modes); mode++) {
+		for (int on = 0; on < 2; on++) {
+			// Auto mode can only be turned on.
+			if (fan_modes[mode] == FAN_AUTO_MODE && !on)
+				continue;
+
+			emu = *start;
+			aorus_emu_wmbd(&emu, fan_modes[mode],
+				fan_modes[mode] == FAN_AUTO_MODE ? speed : on, &output);
+			found = shortest_switch(&emu, to, speed, depth - 1);
+			if (found >= 0 && (best < 0 || found + 1 < best))
+				best = found + 1;
+		}
+	}
+	return best;
+}
+
+/*
+ * Every switch between two of the 6 modes leaves the EC in the new mode, with
+ * the fan speeds only set when entering auto mode, and takes no more WMBD
+ * calls than the shortest sequence that does so.
+ */
+static void test_fan_mode_transitions(void)
+{
+	u8 speed = fan_speed_to_duty(90), old_speed = fan_speed_to_duty(35);
+	struct aorus_emu emu;
+	int calls, shortest;
+	u8 fan;
+
+	for (int from = 0; from < ARRAY_SIZE(fan_modes); from++) {
+		for (int to = 0; to < ARRAY_SIZE(fan_modes); to++) {
+			aorus_emu_init(&emu);
+			aorus_emu_set_fan_mode(&emu, from);
+			fan = from == 4 ? speed : old_speed;
+			emu.ec[EMU_FAN1] = fan;
+			emu.ec[EMU_FAN2] = fan;
+
+			shortest = shortest_switch(&emu, to, speed, FAN_MODE_OPS);
+			CHECK(!gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, from, to, speed));
+			calls = emu.stats.wmbd;
+
+			if (!emu_in_mode(&emu, to) || calls != shortest)
+				printf("#   switch from %d to %d: mode %d after %d calls, shortest is %d\n",
+					from, to, aorus_emu_fan_mode(&emu), calls, shortest);
+			CHECK(emu_in_mode(&emu, to));
+			CHECK(aorus_emu_fan_mode(&emu) == to);
+			CHECK(aorus_emu_bit(&emu, EMU_GFAN) == (to == 4));
+			CHECK(emu.ec[EMU_FAN1] == (to == 4 ? speed : fan));
+			CHECK(emu.ec[EMU_FAN2] == (to == 4 ? speed : fan));
+			CHECK(calls == shortest);
+			CHECK(from != to || !calls);
+		}
+	}
+}
+
+// Every mode reads back as itself, whether the firmware or the driver set it.
+static void test_read_fan_mode(void)
+{
+	struct aorus_emu emu;
+	u8 silent_method;
+	int mode;
+
+	for (int old = 0; old < 2; old++) {
+		for (int to = 0; to < ARRAY_SIZE(fan_modes); to++) {
+			aorus_emu_init(&emu);
+			emu.old_silent = old;
+			silent_method = gigabyte_laptop_probe_silent_method(&aorus_emu_fw_ops, &emu);
+			aorus_emu_set_fan_mode(&emu, to);
+			mode = -1;
+			CHECK(!gigabyte_laptop_read_fan_mode(&aorus_emu_fw_ops, &emu, silent_method,
+				&mode));
+			CHECK(mode == to);
+
+			aorus_emu_init(&emu);
+			emu.old_silent = old;
+			aorus_emu_set_fan_mode(&emu, 3);
+			CHECK(!gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, 3, to, 0x80));
+			mode = -1;
+			CHECK(!gigabyte_laptop_read_fan_mode(&aorus_emu_fw_ops, &emu, silent_method,
+				&mode));
+			if (mode != to)
+				printf("#   mode %d read back as %d\n", to, mode);
+			CHECK(mode == to);
+		}
+	}
+}
+
+/* Thermal model ******************************************/
+
+static int run_fixed(int speed)
+{
+	struct aorus_emu emu;
+	int output;
+
+	aorus_emu_init(&emu);
+	emu.cpu_power = 45000;
+	gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, 0, 5, 0);
+	aorus_emu_wmbd(&emu, FAN_CUSTOM_SPEED, fan_speed_to_duty(speed), &output);
+	aorus_emu_advance(&emu, 300000);
+	aorus_emu_wmbc(&emu, TEMP_CPU, 0, &output);
+	return output;
+}
+
+static void test_thermal_model(void)
+{
+	struct aorus_emu emu;
+	int slow = run_fixed(25), fast = run_fixed(100);
+
+	printf("# CPU at 45 W after 5 minutes: %d C at 25%%, %d C at 100%%\n", slow, fast);
+	CHECK(fast < slow);
+	CHECK(fast > 25 && slow < 150);
+
+	// Fans settle within a few seconds of a new duty.
+	aorus_emu_init(&emu);
+	aorus_emu_set_fan_mode(&emu, 5);
+	emu.ec[EMU_FAN1] = FAN_DUTY_MAX;
+	aorus_emu_advance(&emu, 5000);
+	CHECK(emu.rpm[0] > EMU_RPM_MAX * 95 / 100);
+}
+
+/* Replay *************************************************/
+
+static u32 emu_calls(const struct aorus_emu *emu)
+{
+	return emu->stats.wmbc + emu->stats.wmbd + emu->stats.ec_read + emu->stats.ec_write;
+}
+
+/*
+ * Each sequence replayed from a recording of the emulator makes the same
+ * calls and gets the same answers, and the emulator agrees with the recording.
+ */
+static void test_replay(void)
+{
+	static struct aorus_laptop_call calls[1024];
+	struct emu_replay_method methods[64];
+	struct gigabyte_laptop_sensors recorded = { 0 }, replayed = { 0 };
+	struct emu_recorder rec;
+	struct emu_replay replay;
+	struct aorus_emu emu;
+	int used;
+
+	for (int i = 0; i < EMU_SEQUENCES; i++) {
+		aorus_emu_init(&emu);
+		rec = (struct emu_recorder){ .emu = &emu, .calls = calls, .size = ARRAY_SIZE(calls) };
+		emu_sequences[i].run(&emu_recorder_fw_ops, &rec);
+		CHECK(rec.count && rec.count < rec.size);
+		CHECK(rec.count == emu_calls(&emu));
+
+		replay = (struct emu_replay){ .calls = calls, .count = rec.count };
+		emu_sequences[i].run(&emu_replay_fw_ops, &replay);
+		CHECK(!replay.missing);
+		CHECK(replay.answered == rec.count);
+		CHECK(replay.duration_ns == emu.stats.busy_us * 1000);
+
+		aorus_emu_init(&emu);
+		used = emu_replay_compare(&emu, calls, rec.count, methods, ARRAY_SIZE(methods));
+		CHECK(used > 0);
+		for (int n = 0; n < used; n++) {
+			CHECK(!methods[n].mismatches);
+			CHECK(methods[n].recorded_ns == methods[n].modeled_us * 1000);
+		}
+	}
+
+	// Answers are the recorded ones, and calls that were not recorded fail.
+	aorus_emu_init(&emu);
+	emu.cpu_power = 45000;
+	aorus_emu_advance(&emu, 5000);
+	rec = (struct emu_recorder){ .emu = &emu, .calls = calls, .size = ARRAY_SIZE(calls) };
+	gigabyte_laptop_read_sensors(&emu_recorder_fw_ops, &rec, &aorus_emu_ec_map,
+		EMU_TEMP_PRESENT, EMU_FAN_PRESENT, &recorded);
+	aorus_emu_advance(&emu, 5000);
+
+	replay = (struct emu_replay){ .calls = calls, .count = rec.count };
+	gigabyte_laptop_read_sensors(&emu_replay_fw_ops, &replay, &aorus_emu_ec_map,
+		EMU_TEMP_PRESENT, EMU_FAN_PRESENT, &replayed);
+	CHECK(!memcmp(&recorded, &replayed, sizeof(recorded)));
+
+	replay = (struct emu_replay){ .calls = calls, .count = rec.count };
+	gigabyte_laptop_read_sensors(&emu_replay_fw_ops, &replay, &aorus_emu_wmi_map,
+		EMU_TEMP_PRESENT, EMU_FAN_PRESENT, &replayed);
+	CHECK(replay.missing);
+}
+
+/* Benchmarks *********************************************/
+
+static void bench_sensor_sample(void)
+{
+	struct gigabyte_laptop_sensors sample = { 0 };
+	struct emu_cost wmi, ec;
+	struct aorus_emu emu;
+
+	aorus_emu_init(&emu);
+
+	cost_begin(&emu, &wmi);
+	gigabyte_laptop_read_sensors(&aorus_emu_fw_ops, &emu, &aorus_emu_wmi_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &sample);
+	cost_end(&emu, &wmi);
+	cost_print("Sensor sample through WMI", &wmi);
+
+	cost_begin(&emu, &ec);
+	gigabyte_laptop_read_sensors(&aorus_emu_fw_ops, &emu, &aorus_emu_ec_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &sample);
+	cost_end(&emu, &ec);
+	cost_print("Sensor sample from the EC", &ec);
+
+	// 4 temperatures and 2 RPMs of 2 bytes.
+	CHECK(ec.wmi == 0);
+	CHECK(ec.ec == 4 + 2 * 2);
+	CHECK(ec.us < wmi.us);
+}
+
+static void bench_fan_mode_switch(void)
+{
+	struct emu_cost cost, worst = { 0 };
+	struct aorus_emu emu;
+	u64 total = 0;
+
+	for (int from = 0; from < ARRAY_SIZE(fan_modes); from++) {
+		for (int to = 0; to < ARRAY_SIZE(fan_modes); to++) {
+			aorus_emu_init(&emu);
+			aorus_emu_set_fan_mode(&emu, from);
+			cost_begin(&emu, &cost);
+			gigabyte_laptop_switch_fan_mode(&aorus_emu_fw_ops, &emu, from, to, 0x80);
+			cost_end(&emu, &cost);
+			total += cost.us;
+			if (cost.us > worst.us)
+				worst = cost;
+		}
+	}
+	cost_print("Slowest fan mode switch", &worst);
+	printf("# %-32s %8llu us\n", "Average fan mode switch",
+		(unsigned long long)(total / (ARRAY_SIZE(fan_modes) * ARRAY_SIZE(fan_modes))));
+	CHECK(worst.wmi <= FAN_MODE_OPS);
+}
+
+/* Runner *************************************************/
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} tests[] = {
+	{ "speed_tables", test_speed_tables },
+	{ "convert_fan_rpm", test_convert_fan_rpm },
+	{ "probe_silent_method", test_probe_silent_method },
+	{ "probe_dual_fan", test_probe_dual_fan },
+	{ "probe_state", test_probe_state },
+	{ "read_sensors", test_read_sensors },
+	{ "fan_curve", test_fan_curve },
+	{ "fan_curve_point", test_fan_curve_point },
+	{ "fan_mode_switch", test_fan_mode_switch },
+	{ "fan_mode_transitions", test_fan_mode_transitions },
+	{ "read_fan_mode", test_read_fan_mode },
+	{ "thermal_model", test_thermal_model },
+	{ "replay", test_replay },
+	{ "bench_sensor_sample", bench_sensor_sample },
+	{ "bench_fan_mode_switch", bench_fan_mode_switch },
+};
+
+int main(void)
+{
+	int status = 0;
+
+	printf("1..%zu\n", ARRAY_SIZE(tests));
+	for (int i = 0; i < ARRAY_SIZE(tests); i++) {
+		failed = 0;
+		tests[i].run();
+		printf("%sok %d - %s\n", failed ? "not " : "", i + 1, tests[i].name);
+		status |= failed;
+	}
+	return status;
+}
@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  emu.c - Emulated firmware of an AORUS laptop, for the driver tests
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  WMBC and WMBD follow Aero-15-Classic-DSDT.dsl case by case, on top of the
+ *  ECDV fields they use. What the EC firmware does on its own (fan curves,
+ *  fan speeds and temperatures) is a simple model. Builds both in userspace
+ *  and in the kernel, for the KUnit suite.
+ */
+
+#ifdef __KERNEL__
+#include <linux/errno.h>
+#include <linux/minmax.h>
+#include <linux/string.h>
+#else
+#include <string.h>
+
+#define clamp(val, lo, hi) ((val) < (lo) ? (lo) : (val) > (hi) ? (hi) : (val))
+#endif
+
+#include "emu.h"
+
+/* EC space ***********************************************/
+
+// Every ECDV access made by AML is one EC transaction.
+static u8 emu_field_read(struct aorus_emu *emu, u8 reg)
+{
+	emu->stats.ec_transactions++;
+	emu->stats.busy_us += EMU_EC_US;
+	return emu->ec[reg];
+}
+
+static void emu_field_write(struct aorus_emu *emu, u8 reg, u8 val)
+{
+	emu->stats.ec_transactions++;
+	emu->stats.busy_us += EMU_EC_US;
+	emu->ec[reg] = val;
+}
+
+static int emu_bit_read(struct aorus_emu *emu, int field)
+{
+	return emu_field_read(emu, field >> 3) >> (field & 7) & 1;
+}
+
+// Fields are Preserve, so writing a bit reads the register first.
+static void emu_bit_write(struct aorus_emu *emu, int field, u32 val)
+{
+	u8 reg = emu_field_read(emu, field >> 3);
+
+	if (val & 1)
+		reg |= BIT(field & 7);
+	else
+		reg &= ~BIT(field & 7);
+	emu_field_write(emu, field >> 3, reg);
+}
+
+bool aorus_emu_bit(const struct aorus_emu *emu, int field)
+{
+	return emu->ec[field >> 3] >> (field & 7) & 1;
+}
+
+static void emu_bit_set(struct aorus_emu *emu, int field, bool on)
+{
+	if (on)
+		emu->ec[field >> 3] |= BIT(field & 7);
+	else
+		emu->ec[field >> 3] &= ~BIT(field & 7);
+}
+
+/*
+ * The EC firmware picks up fan curve points written to XFNW, and answers
+ * reads of XFNR through XFN1.
+ */
+static void emu_ec_firmware(struct aorus_emu *emu, u8 reg)
+{
+	u8 index;
+
+	if (reg >= EMU_XFNW && reg < EMU_XFNW + 3) {
+		index = emu->ec[EMU_XFNW];
+		if (index < FAN_CURVE_POINTS) {
+			emu->curve_temperature[index] = emu->ec[EMU_XFNW + 1];
+			emu->curve_speed[index] = emu->ec[EMU_XFNW + 2];
+		}
+	} else if (reg == EMU_XFNR) {
+		index = emu->ec[EMU_XFNR];
+		emu->ec[EMU_XFN1] = index < FAN_CURVE_POINTS ? emu->curve_temperature[index] : 0;
+		emu->ec[EMU_XFN1 + 1] = index < FAN_CURVE_POINTS ? emu->curve_speed[index] : 0;
+	}
+}
+
+/* WMI methods ********************************************/
+
+static int emu_return(int *result, u32 value)
+{
+	*result = value;
+	return 0;
+}
+
+// Methods that fall off the end of their case return nothing.
+#define EMU_NO_RESULT -ENODATA
+
+int aorus_emu_wmbd(struct aorus_emu *emu, u8 method, u32 arg, int *result)
+{
+	emu->stats.wmbd++;
+	emu->stats.busy_us += EMU_WMI_US;
+
+	// Older models use 0xFA for silent mode, and answer it.
+	if (method == FAN_SILENT_OLD && emu->old_silent)
+		method = FAN_SILENT_MODE;
+
+	switch (method) {
+		case 0xFA:
+			return EMU_NO_RESULT;
+		case 0xCA:
+			emu_bit_write(emu, EMU_PSON, arg);
+			return emu_return(result, emu_bit_read(emu, EMU_PSON));
+		case 0xC2:
+			emu_bit_write(emu, EMU_WNON, arg);
+			return EMU_NO_RESULT;
+		case 0x7A:
+			emu_bit_write(emu, EMU_S3UC, arg);
+			return EMU_NO_RESULT;
+		case 0x7B:
+			emu_bit_write(emu, EMU_S4UC, arg);
+			return EMU_NO_RESULT;
+		case 0x7D:
+			emu_bit_write(emu, EMU_TFAN, arg);
+			return EMU_NO_RESULT;
+		case 0x71:
+			emu_bit_write(emu, EMU_GFAN, 0);
+			emu_bit_write(emu, EMU_FANB, arg);
+			return emu_return(result, emu_bit_read(emu, EMU_FANB));
+		case 0x70:
+			emu_bit_write(emu, EMU_TFAN, 0);
+			emu_bit_write(emu, EMU_GFAN, 1);
+			emu_field_write(emu, EMU_FAN1, arg);
+			emu_field_write(emu, EMU_FAN2, arg);
+			return emu_return(result, emu_field_read(emu, EMU_FAN1));
+		case 0x57:
+			emu_bit_write(emu, EMU_GFAN, 0);
+			emu_bit_write(emu, EMU_CRAF, arg);
+			return emu_return(result, emu_bit_read(emu, EMU_CRAF));
+		case 0x6A:
+			emu_bit_write(emu, EMU_ADJF, arg);
+			return emu_return(result, emu_bit_read(emu, EMU_ADJF));
+		case 0x6B:
+			// Newer models only set FAN1 here, see gigabyte_laptop_probe_dual_fan().
+			emu_field_write(emu, EMU_FAN1, arg);
+			if (!emu->dual_fan)
+				emu_field_write(emu, EMU_FAN2, arg);
+			return emu_return(result, emu_field_read(emu, EMU_FAN1));
+		case 0x68:
+			for (int i = 0; i < 3; i++) {
+				emu_field_write(emu, EMU_XFNW + i, arg >> (8 * i));
+				emu_ec_firmware(emu, EMU_XFNW + i);
+			}
+			return emu_return(result, emu_field_read(emu, EMU_XFNW) |
+					emu_field_read(emu, EMU_XFNW + 1) << 8 |
+					emu_field_read(emu, EMU_XFNW + 2) << 16);
+		case 0x67:
+			emu_bit_write(emu, EMU_TENF, arg);
+			return emu_return(result, emu_bit_read(emu, EMU_TENF));
+		case 0x66:
+			emu_field_write(emu, EMU_FLVL, arg);
+			return emu_return(result, emu_field_read(emu, EMU_FLVL));
+		case 0x64:
+			emu_field_write(emu, EMU_BCPS,
+					(emu_field_read(emu, EMU_BCPS) & 0xF0) | (arg & 0x0F));
+			return emu_return(result, emu_field_read(emu, EMU_BCPS) & 0x0F);
+		case 0x65:
+			emu_field_write(emu, EMU_BCPC, arg);
+			return emu_return(result, emu_field_read(emu, EMU_BCPC));
+		case 0x51:
+			emu->temq = arg;
+			return EMU_NO_RESULT;
+		case 0x50:
+			emu_field_write(emu, EMU_FDTY, arg);
+			return emu_return(result, emu_field_read(emu, EMU_FDTY));
+		default:
+			return emu_return(result, arg);
+	}
+}
+
+int aorus_emu_wmbc(struct aorus_emu *emu, u8 method, u32 arg, int *result)
+{
+	emu->stats.wmbc++;
+	emu->stats.busy_us += EMU_WMI_US;
+
+	if (method == 0x03) // Notify (AMW0, 0xD2)
+		return emu_return(result, method);
+
+	if (method == FAN_SILENT_OLD && emu->old_silent)
+		method = FAN_SILENT_MODE;
+
+	switch (method) {
+		case 0xFA:
+			return EMU_NO_RESULT;
+		case 0xC2:
+			return emu_return(result, emu_bit_read(emu, EMU_WNON));
+		case 0xCA:
+			return emu_return(result, emu_bit_read(emu, EMU_PSON));
+		case 0x7A:
+			return emu_return(result, emu_bit_read(emu, EMU_S3UC));
+		case 0x7B:
+			return emu_return(result, emu_bit_read(emu, EMU_S4UC));
+		case 0x7D:
+			return emu_return(result, emu_bit_read(emu, EMU_TFAN));
+		case 0xE1:
+			return emu_return(result, emu_field_read(emu, EMU_TCPU));
+		case 0xE2:
+			return emu_return(result, emu_field_read(emu, EMU_TGP1));
+		case 0xE3:
+			return emu_return(result, emu_field_read(emu, EMU_TGP2));
+		case 0xE4: // 16-bit fields are little-endian
+			return emu_return(result, emu_field_read(emu, EMU_RPM1) |
+					emu_field_read(emu, EMU_RPM1 + 1) << 8);
+		case 0xE5:
+			return emu_return(result, emu_field_read(emu, EMU_RPM2) |
+					emu_field_read(emu, EMU_RPM2 + 1) << 8);
+		case 0x71:
+			return emu_return(result, emu_bit_read(emu, EMU_FANB));
+		case 0x70:
+		case 0x6F:
+		case 0x6B:
+			return emu_return(result, emu_field_read(emu, EMU_FAN1));
+		case 0x57:
+			return emu_return(result, emu_bit_read(emu, EMU_CRAF));
+		case 0x6E:
+			return emu_return(result, emu_field_read(emu, EMU_CYC1));
+		case 0x6D:
+			return emu_return(result, emu_field_read(emu, EMU_CYC2));
+		case 0x6A:
+			return emu_return(result, emu_bit_read(emu, EMU_ADJF));
+		case 0x68:
+			emu_field_write(emu, EMU_XFNR, arg);
+			emu_ec_firmware(emu, EMU_XFNR);
+			emu->stats.busy_us += 100000; // Sleep (0x64)
+			return emu_return(result, emu_field_read(emu, EMU_XFN1) |
+					emu_field_read(emu, EMU_XFN1 + 1) << 8);
+		case 0x67:
+			return emu_return(result, emu_bit_read(emu, EMU_TENF));
+		case 0x64:
+			return emu_return(result, emu_field_read(emu, EMU_BCPS) & 0x0F);
+		case 0x65:
+			return emu_return(result, emu_field_read(emu, EMU_BCPC));
+		case 0x51:
+			return emu_return(result, emu->temq);
+		case 0x50:
+			return emu_return(result, emu_field_read(emu, EMU_FDTY));
+		default:
+			return emu_return(result, arg);
+	}
+}
+
+/* Direct EC access ***************************************/
+
+static void emu_ec_transaction(struct aorus_emu *emu)
+{
+	emu->stats.ec_transactions++;
+	emu->stats.busy_us += EMU_EC_US;
+}
+
+int aorus_emu_ec_read(struct aorus_emu *emu, u8 reg, u8 *val)
+{
+	emu->stats.ec_read++;
+	emu_ec_transaction(emu);
+	*val = emu->ec[reg];
+	return 0;
+}
+
+int aorus_emu_ec_write(struct aorus_emu *emu, u8 reg, u8 val)
+{
+	emu->stats.ec_write++;
+	emu_ec_transaction(emu);
+	emu->ec[reg] = val;
+	emu_ec_firmware(emu, reg);
+	return 0;
+}
+
+/* Driver-side access *************************************/
+
+static int emu_fw_wmbc(void *data, u8 method, u32 arg, int *result)
+{
+	return aorus_emu_wmbc(data, method, arg, result);
+}
+
+static int emu_fw_wmbd(void *data, u8 method, u32 arg, int *result)
+{
+	return aorus_emu_wmbd(data, method, arg, result);
+}
+
+// Like the driver, one register at a time.
+static int emu_fw_ec_read(void *data, u8 start, const u8 *regs, u8 *buf, int count)
+{
+	struct aorus_emu *emu = data;
+	int ret = 0;
+
+	for (int i = 0; i < count && !ret; i++)
+		ret = aorus_emu_ec_read(emu, regs ? regs[i] : start + i, &buf[i]);
+	return ret;
+}
+
+static int emu_fw_ec_write(void *data, u8 reg, u8 val)
+{
+	return aorus_emu_ec_write(data, reg, val);
+}
+
+const struct gigabyte_laptop_fw_ops aorus_emu_fw_ops = {
+	.wmbc = emu_fw_wmbc,
+	.wmbd = emu_fw_wmbd,
+	.ec_read = emu_fw_ec_read,
+	.ec_write = emu_fw_ec_write,
+};
+
+const struct gigabyte_laptop_ec_map aorus_emu_ec_map = {
+	.temp = { EMU_TCPU, EMU_TGP1, EMU_FTP1, EMU_TGP2 },
+	.fan = { EMU_RPM1, EMU_RPM2 },
+};
+
+const struct gigabyte_laptop_ec_map aorus_emu_wmi_map = {
+	.temp = { 0, 0, EMU_FTP1, 0 },
+};
+
+/* Fan modes **********************************************/
+
+// The mode the EC bits describe, numbered like the driver's fan_mode.
+int aorus_emu_fan_mode(const struct aorus_emu *emu)
+{
+	if (aorus_emu_bit(emu, EMU_CRAF))
+		return 1;
+	if (aorus_emu_bit(emu, EMU_FANB))
+		return 2;
+	if (!aorus_emu_bit(emu, EMU_TENF))
+		return 0;
+	if (aorus_emu_bit(emu, EMU_GFAN))
+		return 4;
+	if (aorus_emu_bit(emu, EMU_ADJF))
+		return 5;
+	return 3;
+}
+
+// Put the EC straight into a mode, as if the firmware had switched to it.
+void aorus_emu_set_fan_mode(struct aorus_emu *emu, int mode)
+{
+	emu_bit_set(emu, EMU_CRAF, mode == 1);
+	emu_bit_set(emu, EMU_FANB, mode == 2);
+	emu_bit_set(emu, EMU_TENF, mode >= 3);
+	emu_bit_set(emu, EMU_GFAN, mode == 4);
+	emu_bit_set(emu, EMU_ADJF, mode == 5);
+}
+
+/* Thermal model ******************************************/
+
+#define EMU_STEP_MS 100
+
+// Duty the EC picks for a fan, given the temperature of what it cools.
+static int emu_fan_duty(struct aorus_emu *emu, int fan, int temp)
+{
+	int percent;
+
+	if (aorus_emu_bit(emu, EMU_TENF)) {
+		if (aorus_emu_bit(emu, EMU_GFAN) || aorus_emu_bit(emu, EMU_ADJF))
+			return emu->ec[fan ? EMU_FAN2 : EMU_FAN1];
+
+		// Custom mode runs the curve: the first point at or above temp.
+		percent = emu->curve_speed[FAN_CURVE_POINTS - 1];
+		for (int i = 0; i < FAN_CURVE_POINTS; i++) {
+			if (temp <= emu->curve_temperature[i] * 1000) {
+				percent = emu->curve_speed[i];
+				break;
+			}
+		}
+		return clamp(percent, 0, 100) * FAN_DUTY_MAX / 100;
+	}
+
+	// Built-in curve: 25 percent up to 50 degrees, then 2 percent per degree.
+	percent = clamp(25 + (temp - 50000) / 500, 25, 100);
+	if (aorus_emu_bit(emu, EMU_CRAF))
+		percent = clamp(percent * 3 / 4, 0, 80);
+	else if (aorus_emu_bit(emu, EMU_FANB))
+		percent = clamp(percent + 15, 0, 100);
+	return percent * FAN_DUTY_MAX / 100;
+}
+
+/*
+ * First-order model: heat flows out at 0.3 W/K with the fan stopped, and up
+ * to 1.5 W/K at full speed, into a 40 J/K mass. Fans settle in about a second.
+ */
+static int emu_heat(int temp, int ambient, int power, int rpm)
+{
+	int conductance = 300 + 1200 * rpm / EMU_RPM_MAX; // mW/K
+	int flow = power - conductance * (temp - ambient) / 1000;
+
+	return temp + flow * EMU_STEP_MS / (40 * 1000);
+}
+
+static void emu_publish(struct aorus_emu *emu)
+{
+	emu->ec[EMU_TCPU] = clamp(emu->cpu_temp / 1000, 0, 255);
+	emu->ec[EMU_TGP1] = clamp(emu->gpu_temp / 1000, 0, 255);
+	emu->ec[EMU_FTP1] = clamp((emu->ambient + (emu->cpu_temp - emu->ambient) / 3) / 1000, 0, 255);
+	emu->ec[EMU_TGP2] = 0; // Single GPU
+	emu->ec[EMU_RPM1] = emu->rpm[0] >> 8;
+	emu->ec[EMU_RPM1 + 1] = emu->rpm[0];
+	emu->ec[EMU_RPM2] = emu->rpm[1] >> 8;
+	emu->ec[EMU_RPM2 + 1] = emu->rpm[1];
+}
+
+void aorus_emu_advance(struct aorus_emu *emu, unsigned int ms)
+{
+	for (unsigned int t = 0; t < ms; t += EMU_STEP_MS) {
+		int temps[2] = { emu->cpu_temp, emu->gpu_temp };
+
+		for (int fan = 0; fan < 2; fan++) {
+			int target = emu_fan_duty(emu, fan, temps[fan]) * EMU_RPM_MAX / FAN_DUTY_MAX;
+
+			emu->rpm[fan] += (target - emu->rpm[fan]) * EMU_STEP_MS / 1000;
+		}
+		emu->cpu_temp = emu_heat(emu->cpu_temp, emu->ambient, emu->cpu_power, emu->rpm[0]);
+		emu->gpu_temp = emu_heat(emu->gpu_temp, emu->ambient, emu->gpu_power, emu->rpm[1]);
+		emu->now_ms += EMU_STEP_MS;
+	}
+	emu_publish(emu);
+}
+
+/* Setup **************************************************/
+
+/*
+ * An Aero 15 Classic at idle in normal mode, at 35 percent custom speed and
+ * with a 15 point curve from 40 to 96 degrees. Set dual_fan or old_silent
+ * afterwards to emulate newer or older firmware.
+ */
+void aorus_emu_init(struct aorus_emu *emu)
+{
+	memset(emu, 0, sizeof(*emu));
+	emu->ec[EMU_FAN1] = fan_speed_to_duty(35);
+	emu->ec[EMU_FAN2] = fan_speed_to_duty(35);
+	emu->ec[EMU_BCPC] = 100;
+	emu->ec[EMU_CYC1] = 42;
+	for (int i = 0; i < FAN_CURVE_POINTS; i++) {
+		emu->curve_temperature[i] = 40 + 4 * i;
+		emu->curve_speed[i] = 25 + 5 * i;
+	}
+
+	emu->ambient = 25000;
+	emu->cpu_power = 15000;
+	emu->gpu_power = 10000;
+	emu->cpu_temp = 40000;
+	emu->gpu_temp = 40000;
+	emu_publish(emu);
+}
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  emu.h - Emulated firmware of an AORUS laptop, for the driver tests
+ *
+ *  Copyright (C) 2023 Albert Tang
+ */
+
+#ifndef _AORUS_LAPTOP_EMU_H
+#define _AORUS_LAPTOP_EMU_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The kernel types and helpers aorus-laptop-core.h expects.
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define BIT(nr) (1UL << (nr))
+#define static_assert(expr, ...) _Static_assert(expr, #expr)
+
+static inline u16 rol16(u16 word, unsigned int shift)
+{
+	return (word << (shift & 15)) | (word >> ((-shift) & 15));
+}
+#endif
+
+#include "../aorus-laptop-core.h"
+
+/*
+ * ECDV fields of Aero-15-Classic-DSDT.dsl that WMBC and WMBD touch. Bit
+ * fields are given as register << 3 | bit.
+ */
+#define EMU_S3UC (0x01 << 3 | 5)
+#define EMU_WNON (0x02 << 3 | 6)
+#define EMU_PSON (0x03 << 3 | 5)
+#define EMU_ADJF (0x06 << 3 | 4) // Fixed mode
+#define EMU_S4UC (0x07 << 3 | 2)
+#define EMU_CRAF (0x08 << 3 | 6) // Silent mode
+#define EMU_TFAN (0x0A << 3 | 0)
+#define EMU_FANB (0x0C << 3 | 4) // Gaming mode
+#define EMU_GFAN (0x0D << 3 | 0) // Auto-maximum mode
+#define EMU_TENF (0x0D << 3 | 7) // Custom mode
+
+#define EMU_BCPS 0x0F // Low nibble
+#define EMU_CYC1 0x4E
+#define EMU_CYC2 0x4F
+#define EMU_TCPU 0x60
+#define EMU_TGP1 0x61
+#define EMU_FTP1 0x62
+#define EMU_TGP2 0x64
+#define EMU_FLVL 0x68
+#define EMU_XFNW 0xA0 // 3 bytes: index, temperature, speed
+#define EMU_XFNR 0xA3
+#define EMU_XFN1 0xA4 // 2 bytes: temperature, speed
+#define EMU_BCPC 0xA9
+#define EMU_FAN1 0xB0
+#define EMU_FAN2 0xB1
+#define EMU_FDTY 0xB3
+#define EMU_RPM1 0xFC // Big-endian
+#define EMU_RPM2 0xFE
+
+/*
+ * Firmware time charged per access, in microseconds. These are rough figures
+ * for an ACPI EC, not measurements, and only meant to compare sequences.
+ */
+#define EMU_EC_US  250 // One EC transaction
+#define EMU_WMI_US 150 // Evaluating WMBC or WMBD, without its EC accesses
+
+#define EMU_RPM_MAX 5200
+
+struct aorus_emu_stats {
+	u32 wmbc;
+	u32 wmbd;
+	u32 ec_read;
+	u32 ec_write;
+	u32 ec_transactions; // Including the ones made by AML
+	u64 busy_us;
+};
+
+struct aorus_emu {
+	u8 ec[256];
+	u32 temq; // PEG0.PEGP.TEMQ, GPU boost
+
+	// Fan curve kept by the EC firmware, reached through XFNW and XFNR.
+	u8 curve_temperature[FAN_CURVE_POINTS];
+	u8 curve_speed[FAN_CURVE_POINTS];
+
+	// Firmware variants, see aorus_emu_init().
+	bool dual_fan;
+	bool old_silent;
+
+	struct aorus_emu_stats stats;
+
+	// Thermal model. Temperatures in millidegrees, power in milliwatts.
+	u64 now_ms;
+	int ambient;
+	int cpu_power;
+	int gpu_power;
+	int cpu_temp;
+	int gpu_temp;
+	int rpm[2];
+};
+
+void aorus_emu_init(struct aorus_emu *emu);
+int aorus_emu_wmbc(struct aorus_emu *emu, u8 method, u32 arg, int *result);
+int aorus_emu_wmbd(struct aorus_emu *emu, u8 method, u32 arg, int *result);
+int aorus_emu_ec_read(struct aorus_emu *emu, u8 reg, u8 *val);
+int aorus_emu_ec_write(struct aorus_emu *emu, u8 reg, u8 val);
+void aorus_emu_advance(struct aorus_emu *emu, unsigned int ms);
+
+bool aorus_emu_bit(const struct aorus_emu *emu, int field);
+int aorus_emu_fan_mode(const struct aorus_emu *emu);
+void aorus_emu_set_fan_mode(struct aorus_emu *emu, int mode);
+
+// Driver-side access, like the driver's ops. The data pointer is the emulator.
+extern const struct gigabyte_laptop_fw_ops aorus_emu_fw_ops;
+
+// The driver's aero_ec_map, and its default map where only FTP1 is in the EC.
+extern const struct gigabyte_laptop_ec_map aorus_emu_ec_map;
+extern const struct gigabyte_laptop_ec_map aorus_emu_wmi_map;
+
+// Sensor channels of the emulated model: 4 temperatures and 2 fans.
+#define EMU_TEMP_PRESENT 0x0F
+#define EMU_FAN_PRESENT  0x03
+
+#endif
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  replay.c - Recorded firmware calls, for the driver tests
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Calls are recorded as struct aorus_laptop_call, in the format of the
+ *  driver's aorus_laptop/calls debugfs file, so recordings of a laptop and
+ *  of the emulator can be replayed alike.
+ */
+
+#include <string.h>
+
+#include "replay.h"
+
+#define REPLAY_AE_ERROR 1
+
+// Like gigabyte_laptop_ec_read_block(), one register at a time.
+static int replay_ec_read_block(int (*io)(void *data, u8 type, u8 reg, u8 *val), void *data,
+				u8 start, const u8 *regs, u8 *buf, int count)
+{
+	int ret = 0;
+
+	for (int i = 0; i < count && !ret; i++)
+		ret = io(data, AORUS_LAPTOP_CALL_EC_READ, regs ? regs[i] : start + i, &buf[i]);
+	return ret;
+}
+
+/* Recording **********************************************/
+
+static void recorder_push(struct emu_recorder *rec, struct aorus_laptop_call *call, u64 start_us)
+{
+	call->duration = (rec->emu->stats.busy_us - start_us) * 1000;
+	if (rec->count < rec->size)
+		rec->calls[rec->count++] = *call;
+}
+
+static int recorder_wmi(struct emu_recorder *rec, u8 type, u8 method, u32 arg, int *result)
+{
+	struct aorus_laptop_call call = { .type = type, .method = method, .arg = arg };
+	u64 start = rec->emu->stats.busy_us;
+	int ret;
+
+	if (type == AORUS_LAPTOP_CALL_WMBC)
+		ret = aorus_emu_wmbc(rec->emu, method, arg, result);
+	else
+		ret = aorus_emu_wmbd(rec->emu, method, arg, result);
+
+	if (!ret) {
+		call.result = REPLAY_ACPI_INTEGER;
+		call.value = (u32)*result;
+	} else if (ret != -ENODATA) {
+		call.status = REPLAY_AE_ERROR;
+	}
+	recorder_push(rec, &call, start);
+	return ret;
+}
+
+static int recorder_ec_io(void *data, u8 type, u8 reg, u8 *val)
+{
+	struct emu_recorder *rec = data;
+	struct aorus_laptop_call call = { .type = type, .method = reg };
+	u64 start = rec->emu->stats.busy_us;
+	int ret;
+
+	if (type == AORUS_LAPTOP_CALL_EC_WRITE) {
+		ret = aorus_emu_ec_write(rec->emu, reg, *val);
+		call.arg = *val;
+	} else {
+		ret = aorus_emu_ec_read(rec->emu, reg, val);
+	}
+
+	call.status = ret;
+	if (!ret && type == AORUS_LAPTOP_CALL_EC_READ)
+		call.value = *val;
+	recorder_push(rec, &call, start);
+	return ret;
+}
+
+static int recorder_wmbc(void *data, u8 method, u32 arg, int *result)
+{
+	return recorder_wmi(data, AORUS_LAPTOP_CALL_WMBC, method, arg, result);
+}
+
+static int recorder_wmbd(void *data, u8 method, u32 arg, int *result)
+{
+	return recorder_wmi(data, AORUS_LAPTOP_CALL_WMBD, method, arg, result);
+}
+
+static int recorder_ec_read(void *data, u8 start, const u8 *regs, u8 *buf, int count)
+{
+	return replay_ec_read_block(recorder_ec_io, data, start, regs, buf, count);
+}
+
+static int recorder_ec_write(void *data, u8 reg, u8 val)
+{
+	return recorder_ec_io(data, AORUS_LAPTOP_CALL_EC_WRITE, reg, &val);
+}
+
+const struct gigabyte_laptop_fw_ops emu_recorder_fw_ops = {
+	.wmbc = recorder_wmbc,
+	.wmbd = recorder_wmbd,
+	.ec_read = recorder_ec_read,
+	.ec_write = recorder_ec_write,
+};
+
+/* Replay *************************************************/
+
+static bool replay_find(struct emu_replay *replay, u8 type, u8 method, u32 arg,
+			struct aorus_laptop_call *call)
+{
+	const struct aorus_laptop_call *calls = replay->calls;
+	u32 n;
+
+	for (u32 i = 0; i < replay->count; i++) {
+		n = (replay->pos + i) % replay->count;
+		if (calls[n].type != type || calls[n].method != method)
+			continue;
+		if (type <= AORUS_LAPTOP_CALL_WMBD && calls[n].arg != arg)
+			continue;
+
+		*call = calls[n];
+		replay->pos = n + 1;
+		replay->answered++;
+		replay->duration_ns += call->duration;
+		return true;
+	}
+
+	replay->missing++;
+	return false;
+}
+
+// Same errors as gigabyte_laptop_wmi_integer(), except for the ACPI status.
+static int replay_wmi(struct emu_replay *replay, u8 type, u8 method, u32 arg, int *result)
+{
+	struct aorus_laptop_call call;
+
+	if (!replay_find(replay, type, method, arg, &call))
+		return -ENOENT;
+	if (call.status)
+		return -EIO;
+
+	switch (call.result) {
+		case 0:
+			return -ENODATA;
+		case REPLAY_ACPI_INTEGER:
+			*result = call.value;
+			return 0;
+		case REPLAY_ACPI_BUFFER:
+			return call.length ? -EMSGSIZE : -ENODATA;
+		default:
+			return -EPROTO;
+	}
+}
+
+static int replay_ec_io(void *data, u8 type, u8 reg, u8 *val)
+{
+	struct aorus_laptop_call call;
+
+	if (!replay_find(data, type, reg, 0, &call))
+		return -ENOENT;
+	if (call.status)
+		return (int)call.status;
+	if (val && type != AORUS_LAPTOP_CALL_EC_WRITE)
+		*val = call.value;
+	return 0;
+}
+
+static int replay_wmbc(void *data, u8 method, u32 arg, int *result)
+{
+	return replay_wmi(data, AORUS_LAPTOP_CALL_WMBC, method, arg, result);
+}
+
+static int replay_wmbd(void *data, u8 method, u32 arg, int *result)
+{
+	return replay_wmi(data, AORUS_LAPTOP_CALL_WMBD, method, arg, result);
+}
+
+static int replay_ec_read(void *data, u8 start, const u8 *regs, u8 *buf, int count)
+{
+	return replay_ec_read_block(replay_ec_io, data, start, regs, buf, count);
+}
+
+static int replay_ec_write(void *data, u8 reg, u8 val)
+{
+	return replay_ec_io(data, AORUS_LAPTOP_CALL_EC_WRITE, reg, &val);
+}
+
+const struct gigabyte_laptop_fw_ops emu_replay_fw_ops = {
+	.wmbc = replay_wmbc,
+	.wmbd = replay_wmbd,
+	.ec_read = replay_ec_read,
+	.ec_write = replay_ec_write,
+};
+
+/* Comparison *********************************************/
+
+// Whether the call returned something, as opposed to failing or returning nothing.
+static bool replay_answered(const struct aorus_laptop_call *call)
+{
+	if (call->type <= AORUS_LAPTOP_CALL_WMBD)
+		return !call->status && call->result == REPLAY_ACPI_INTEGER;
+	return !call->status;
+}
+
+static int emu_call(struct aorus_emu *emu, const struct aorus_laptop_call *call)
+{
+	int result;
+	u8 val;
+
+	switch (call->type) {
+		case AORUS_LAPTOP_CALL_WMBC:
+			return aorus_emu_wmbc(emu, call->method, call->arg, &result);
+		case AORUS_LAPTOP_CALL_WMBD:
+			return aorus_emu_wmbd(emu, call->method, call->arg, &result);
+		case AORUS_LAPTOP_CALL_EC_READ:
+			return aorus_emu_ec_read(emu, call->method, &val);
+		case AORUS_LAPTOP_CALL_EC_WRITE:
+			return aorus_emu_ec_write(emu, call->method, call->arg);
+		default:
+			return -EINVAL;
+	}
+}
+
+/*
+ * Make every recorded call to the emulator, in order, and sum them up per
+ * method into methods. Returns the number of methods, or -ENOSPC if there
+ * are more than size.
+ */
+int emu_replay_compare(struct aorus_emu *emu, const struct aorus_laptop_call *calls, u32 count,
+		struct emu_replay_method *methods, int size)
+{
+	struct emu_replay_method *method;
+	int used = 0, ret;
+	u64 start;
+
+	for (u32 i = 0; i < count; i++) {
+		method = NULL;
+		for (int n = 0; n < used && !method; n++)
+			if (methods[n].type == calls[i].type && methods[n].method == calls[i].method)
+				method = &methods[n];
+		if (!method) {
+			if (used == size)
+				return -ENOSPC;
+			method = &methods[used++];
+			memset(method, 0, sizeof(*method));
+			method->type = calls[i].type;
+			method->method = calls[i].method;
+		}
+
+		start = emu->stats.busy_us;
+		ret = emu_call(emu, &calls[i]);
+		method->calls++;
+		method->mismatches += !ret != replay_answered(&calls[i]);
+		method->recorded_ns += calls[i].duration;
+		method->modeled_us += emu->stats.busy_us - start;
+	}
+	return used;
+}
+
+/* Sequences **********************************************/
+
+static void sequence_sample_ec(const struct gigabyte_laptop_fw_ops *fw, void *data)
+{
+	struct gigabyte_laptop_sensors sample = { 0 };
+
+	gigabyte_laptop_read_sensors(fw, data, &aorus_emu_ec_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &sample);
+}
+
+static void sequence_sample_wmi(const struct gigabyte_laptop_fw_ops *fw, void *data)
+{
+	struct gigabyte_laptop_sensors sample = { 0 };
+
+	gigabyte_laptop_read_sensors(fw, data, &aorus_emu_wmi_map, EMU_TEMP_PRESENT,
+		EMU_FAN_PRESENT, &sample);
+}
+
+// gigabyte_laptop_probe(), then the dual fan check of the deferred probe.
+static void sequence_probe(const struct gigabyte_laptop_fw_ops *fw, void *data)
+{
+	struct gigabyte_laptop_probe_state state = { .charge = true };
+
+	gigabyte_laptop_probe_state(fw, data, &state);
+	gigabyte_laptop_probe_dual_fan(fw, data, state.custom_speed);
+}
+
+static void sequence_fan_curve(const struct gigabyte_laptop_fw_ops *fw, void *data)
+{
+	int output;
+
+	for (u8 i = 0; i < FAN_CURVE_POINTS; i++)
+		fw->wmbc(data, FAN_INDEX_VALUE, i, &output);
+}
+
+// From normal mode to every other mode and back.
+static void sequence_fan_modes(const struct gigabyte_laptop_fw_ops *fw, void *data)
+{
+	for (int mode = 1; mode < ARRAY_SIZE(fan_modes); mode++) {
+		gigabyte_laptop_switch_fan_mode(fw, data, 0, mode, fan_speed_to_duty(60));
+		gigabyte_laptop_switch_fan_mode(fw, data, mode, 0, fan_speed_to_duty(60));
+	}
+}
+
+const struct emu_sequence emu_sequences[EMU_SEQUENCES] = {
+	{ "Sensor sample from the EC", sequence_sample_ec },
+	{ "Sensor sample through WMI", sequence_sample_wmi },
+	{ "Probe", sequence_probe },
+	{ "Read the fan curve", sequence_fan_curve },
+	{ "Switch fan modes", sequence_fan_modes },
+};
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ *  replay.h - Recorded firmware calls, for the driver tests
+ *
+ *  Copyright (C) 2023 Albert Tang
+ */
+
+#ifndef _AORUS_LAPTOP_REPLAY_H
+#define _AORUS_LAPTOP_REPLAY_H
+
+#include "../aorus-laptop.h"
+#include "emu.h"
+
+// ACPI object types, as struct aorus_laptop_call.result holds them.
+#define REPLAY_ACPI_INTEGER 1
+#define REPLAY_ACPI_BUFFER  3
+
+/*
+ * Records the calls made to the emulator like the driver records the ones it
+ * makes to the firmware, durations being the emulator's. calls holds size
+ * records, and calls past that are not recorded.
+ */
+struct emu_recorder {
+	struct aorus_emu *emu;
+	struct aorus_laptop_call *calls;
+	u32 count;
+	u32 size;
+};
+
+extern const struct gigabyte_laptop_fw_ops emu_recorder_fw_ops;
+
+/*
+ * Answers each call with the next recorded call of the same method (and
+ * argument, for WMI), like the firmware did. Calls that were never recorded
+ * fail with -ENOENT and are counted in missing.
+ */
+struct emu_replay {
+	const struct aorus_laptop_call *calls;
+	u32 count;
+	u32 pos;
+	u32 answered;
+	u32 missing;
+	u64 duration_ns; // Recorded time of the calls answered
+};
+
+extern const struct gigabyte_laptop_fw_ops emu_replay_fw_ops;
+
+// Calls of one type and method, replayed on the emulator.
+struct emu_replay_method {
+	u8 type;
+	u8 method;
+	u32 calls;
+	u32 mismatches; // Answered by one but not the other
+	u64 recorded_ns;
+	u64 modeled_us;
+};
+
+int emu_replay_compare(struct aorus_emu *emu, const struct aorus_laptop_call *calls, u32 count,
+		struct emu_replay_method *methods, int size);
+
+// What the driver does with the firmware, run against a recording or the emulator.
+struct emu_sequence {
+	const char *name;
+	void (*run)(const struct gigabyte_laptop_fw_ops *fw, void *data);
+};
+
+#define EMU_SEQUENCES 5
+
+extern const struct emu_sequence emu_sequences[EMU_SEQUENCES];
+
+#endif
@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ *  stress.c - Concurrent reads and writes of the driver's sysfs nodes
+ *
+ *  Copyright (C) 2023 Albert Tang
+ *
+ *  Usage: stress [-t THREADS] [-s SECONDS], as root, with the driver loaded.
+ *  Reader threads read the hwmon channels, fan_mode and fan_curve in a loop,
+ *  first alone and then while writers switch fan modes and rewrite the fan
+ *  curve, both whole and point by point. The fan curve is written back
+ *  unchanged, and the fan mode is restored at the end.
+ *
+ *  Fails if a read errors or returns something malformed, if a write fails,
+ *  or if the kernel logs a warning or a lockdep splat meanwhile. On kernels
+ *  built with CONFIG_PROVE_LOCKING, lockdep checks every lock the driver
+ *  takes along the way.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PLATFORM "/sys/devices/platform/aorus_laptop/"
+
+#define MAX_THREADS 256
+#define MAX_FILES   16
+#define CURVE_POINTS 15
+
+struct reader {
+	pthread_t thread;
+	int fds[MAX_FILES];
+	int count;
+	unsigned long reads;
+};
+
+static const char *read_paths[MAX_FILES];
+static int read_count;
+
+static atomic_bool stop;
+static atomic_bool writing;
+static atomic_int errors;
+static atomic_ulong writes;
+
+static unsigned int curve_temperature[CURVE_POINTS];
+static unsigned int curve_speed[CURVE_POINTS];
+static char curve_text[512];
+
+static void fail(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void fail(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	atomic_fetch_add(&errors, 1);
+}
+
+static int read_node(const char *path, char *buf, size_t size)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0)
+		return -errno;
+	buf[len] = '\0';
+	return 0;
+}
+
+static int write_node(const char *path, const char *value)
+{
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	len = write(fd, value, strlen(value));
+	close(fd);
+	return len < 0 ? -errno : 0;
+}
+
+static void write_checked(const char *node, const char *value)
+{
+	int ret = write_node(node, value);
+
+	if (ret)
+		fail("Writing %s to %s failed: %s\n", value, node, strerror(-ret));
+	else
+		atomic_fetch_add(&writes, 1);
+}
+
+static int parse_curve(const char *text, unsigned int *temperature, unsigned int *speed)
+{
+	int n;
+
+	for (int i = 0; i < CURVE_POINTS; i++) {
+		if (sscanf(text, "%u %u\n%n", &temperature[i], &speed[i], &n) != 2)
+			return -EINVAL;
+		text += n;
+	}
+	return *text ? -EINVAL : 0;
+}
+
+/* Readers ************************************************/
+
+// Values of the nodes are checked as well as read.
+static void check_value(const char *path, const char *buf)
+{
+	unsigned int temperature[CURVE_POINTS], speed[CURVE_POINTS];
+	char *end;
+	long val;
+
+	if (strstr(path, "fan_curve")) {
+		if (parse_curve(buf, temperature, speed))
+			fail("Malformed fan curve:\n%s", buf);
+		return;
+	}
+
+	val = strtol(buf, &end, 10);
+	if (end == buf || *end != '\n')
+		fail("Malformed value in %s: %s", path, buf);
+	else if (strstr(path, "fan_mode") && (val < 0 || val > 5))
+		fail("Invalid fan mode %ld\n", val);
+}
+
+static void *reader_run(void *data)
+{
+	struct reader *reader = data;
+	char buf[512];
+	ssize_t len;
+
+	while (!atomic_load(&stop)) {
+		for (int i = 0; i < reader->count; i++) {
+			len = pread(reader->fds[i], buf, sizeof(buf) - 1, 0);
+			// A channel that failed to sample reads as an error until the next sample.
+			if (len < 0 && errno == ENODATA)
+				continue;
+			if (len < 0) {
+				fail("Reading %s failed: %s\n", read_paths[i], strerror(errno));
+				continue;
+			}
+			buf[len] = '\0';
+			check_value(read_paths[i], buf);
+			reader->reads++;
+		}
+	}
+	return NULL;
+}
+
+/* Writers ************************************************/
+
+static void *mode_writer_run(void *data)
+{
+	static const char * const modes[] = { "0", "1", "2", "3" };
+
+	for (unsigned int i = 0; !atomic_load(&stop); i++) {
+		write_checked(PLATFORM "fan_mode", modes[i % 4]);
+		if (i % 8 == 7)
+			write_checked(PLATFORM "sync", "1");
+	}
+	return NULL;
+}
+
+static void *curve_writer_run(void *data)
+{
+	char value[16];
+
+	for (unsigned int i = 0; !atomic_load(&stop); i++) {
+		unsigned int point = i % CURVE_POINTS;
+
+		if (point == 0) {
+			write_checked(PLATFORM "fan_curve", curve_text);
+			continue;
+		}
+		snprintf(value, sizeof(value), "%u", point);
+		write_checked(PLATFORM "fan_curve_index", value);
+		snprintf(value, sizeof(value), "%u",
+			curve_speed[point] << 8 | curve_temperature[point]);
+		write_checked(PLATFORM "fan_curve_data", value);
+	}
+	return NULL;
+}
+
+/* Kernel log *********************************************/
+
+static const char * const splats[] = {
+	"possible circular locking dependency",
+	"possible recursive locking",
+	"inconsistent lock state",
+	"suspicious RCU usage",
+	"WARNING:",
+	"BUG:",
+};
+
+// Opens the kernel log at its end, so that only new messages are read.
+static int kmsg_open(void)
+{
+	int fd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK);
+
+	if (fd >= 0)
+		lseek(fd, 0, SEEK_END);
+	return fd;
+}
+
+static void kmsg_check(int fd)
+{
+	char record[8192];
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, record, sizeof(record) - 1);
+		if (len < 0 && errno == EPIPE) // Overwritten while we read
+			continue;
+		if (len <= 0)
+			break;
+		record[len] = '\0';
+		for (int i = 0; i < sizeof(splats) / sizeof(splats[0]); i++) {
+			if (strstr(record, splats[i])) {
+				fail("Kernel log: %s", strchr(record, ';') ? strchr(record, ';') + 1 : record);
+				break;
+			}
+		}
+	}
+}
+
+// Lockdep turns itself off after its first report, which shows in debug_locks.
+static int lockdep_debug_locks(void)
+{
+	char stats[8192], *line;
+
+	if (read_node("/proc/lockdep_stats", stats, sizeof(stats)))
+		return -1;
+	line = strstr(stats, "debug_locks:");
+	return line ? atoi(line + strlen("debug_locks:")) : -1;
+}
+
+/* Runner *************************************************/
+
+static void add_reads(const char *pattern)
+{
+	glob_t matches;
+
+	if (glob(pattern, 0, NULL, &matches))
+		return;
+	for (size_t i = 0; i < matches.gl_pathc && read_count < MAX_FILES; i++)
+		read_paths[read_count++] = strdup(matches.gl_pathv[i]);
+	globfree(&matches);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs the readers for seconds, and returns how many reads they made per second.
+static double run_readers(struct reader *readers, int threads, int seconds)
+{
+	unsigned long total = 0;
+	double start;
+
+	atomic_store(&stop, false);
+	start = now();
+	for (int i = 0; i < threads; i++) {
+		readers[i].reads = 0;
+		pthread_create(&readers[i].thread, NULL, reader_run, &readers[i]);
+	}
+
+	if (atomic_load(&writing)) {
+		pthread_t mode_writer, curve_writer;
+
+		pthread_create(&mode_writer, NULL, mode_writer_run, NULL);
+		pthread_create(&curve_writer, NULL, curve_writer_run, NULL);
+		sleep(seconds);
+		atomic_store(&stop, true);
+		pthread_join(mode_writer, NULL);
+		pthread_join(curve_writer, NULL);
+	} else {
+		sleep(seconds);
+		atomic_store(&stop, true);
+	}
+
+	for (int i = 0; i < threads; i++) {
+		pthread_join(readers[i].thread, NULL);
+		total += readers[i].reads;
+	}
+	return total / (now() - start);
+}
+
+int main(int argc, char **argv)
+{
+	static struct reader readers[MAX_THREADS];
+	int threads = 8, seconds = 10, kmsg, debug_locks, opt;
+	char fan_mode[16], fan_control[16];
+	double alone, contended;
+
+	while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+		switch (opt) {
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 's':
+				seconds = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-t THREADS] [-s SECONDS]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || seconds < 1) {
+		fprintf(stderr, "Between 1 and %d threads, for at least a second\n", MAX_THREADS);
+		return 2;
+	}
+
+	if (read_node(PLATFORM "fan_mode", fan_mode, sizeof(fan_mode)) ||
+			read_node(PLATFORM "fan_curve", curve_text, sizeof(curve_text)) ||
+			parse_curve(curve_text, curve_temperature, curve_speed)) {
+		fprintf(stderr, "The driver is not loaded, or is too old\n");
+		return 1;
+	}
+	if (!read_node(PLATFORM "fan_control", fan_control, sizeof(fan_control)) &&
+			atoi(fan_control)) {
+		fprintf(stderr, "Turn fan_control off first, it owns the fan mode\n");
+		return 1;
+	}
+
+	add_reads(PLATFORM "hwmon/hwmon*/temp*_input");
+	add_reads(PLATFORM "hwmon/hwmon*/fan*_input");
+	add_reads(PLATFORM "fan_mode");
+	add_reads(PLATFORM "fan_curve");
+	for (int i = 0; i < threads; i++) {
+		readers[i].count = read_count;
+		for (int n = 0; n < read_count; n++) {
+			readers[i].fds[n] = open(read_paths[n], O_RDONLY);
+			if (readers[i].fds[n] < 0) {
+				perror(read_paths[n]);
+				return 1;
+			}
+		}
+	}
+
+	debug_locks = lockdep_debug_locks();
+	if (debug_locks < 0)
+		printf("# Lockdep is not enabled, only the kernel log is checked\n");
+	else if (!debug_locks)
+		printf("# Lockdep already turned itself off, only the kernel log is checked\n");
+	kmsg = kmsg_open();
+	if (kmsg < 0)
+		printf("# Cannot read the kernel log\n");
+
+	printf("# %d readers of %d nodes, %d seconds per run\n", threads, read_count, seconds);
+	alone = run_readers(readers, threads, seconds);
+	printf("Reads per second without writers: %.0f\n", alone);
+
+	atomic_store(&writing, true);
+	contended = run_readers(readers, threads, seconds);
+	printf("Reads per second with writers:    %.0f (%.0f%%)\n", contended,
+		alone ? 100 * contended / alone : 0);
+	printf("Writes per second:                %.0f\n", atomic_load(&writes) / (double)seconds);
+
+	write_checked(PLATFORM "fan_mode", fan_mode);
+	write_checked(PLATFORM "sync", "1");
+
+	if (kmsg >= 0) {
+		kmsg_check(kmsg);
+		close(kmsg);
+	}
+	if (debug_locks > 0 && lockdep_debug_locks() == 0)
+		fail("Lockdep turned itself off, see the kernel log\n");
+
+	printf("%s\n", atomic_load(&errors) ? "FAILED" : "OK");
+	return atomic_load(&errors) ? 1 : 0;
+}